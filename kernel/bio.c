@@ -7,7 +7,8 @@
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
-// * After changing buffer data, call bwrite to write it to disk.
+// * After changing buffer data, call bwrite to write it to disk,
+//     or bwritev to write several buffers at once.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
@@ -111,6 +112,19 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Write the contents of n locked bufs to disk.
+// Runs of consecutive blocks go to the disk as single
+// requests, and all of them are in flight together.
+void
+bwritev(struct buf **bs, int n)
+{
+  for(int i = 0; i < n; i++){
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwritev");
+  }
+  virtio_disk_rwv(bs, n, 1);
+}
+
 // Release a locked buffer.
 // Move to the head of the most-recently-used list.
 void
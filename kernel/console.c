@@ -21,6 +21,8 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "poll.h"
+#include "fcntl.h"
 
 #define BACKSPACE 0x100  // erase the last output character
 #define C(x)  ((x)-'@')  // Control-x
@@ -51,6 +53,7 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+  struct waitq pollq;
 } cons;
 
 //
@@ -80,10 +83,11 @@ consolewrite(int user_src, uint64 src, int n)
 // user read()s from the console go here.
 // copy (up to) a whole input line to dst.
 // user_dst indicates whether dst is a user
-// or kernel address.
+// or kernel address. if nonblock, return what
+// has arrived, or -EAGAIN, instead of waiting.
 //
 int
-consoleread(int user_dst, uint64 dst, int n)
+consoleread(int user_dst, uint64 dst, int n, int nonblock)
 {
   uint target;
   int c;
@@ -99,6 +103,10 @@ consoleread(int user_dst, uint64 dst, int n)
         release(&cons.lock);
         return -1;
       }
+      if(nonblock){
+        release(&cons.lock);
+        return n < target ? target - n : -EAGAIN;
+      }
       sleep(&cons.r, &cons.lock);
     }
 
@@ -132,6 +140,24 @@ consoleread(int user_dst, uint64 dst, int n)
   return target - n;
 }
 
+//
+// poll() on the console: readable once a whole line
+// (or end-of-file) has arrived, always writable.
+//
+int
+consolepoll(struct pollent *e)
+{
+  int r = POLLOUT;
+
+  if(e)
+    pollwait(&cons.pollq, e);
+  acquire(&cons.lock);
+  if(cons.r != cons.w)
+    r |= POLLIN;
+  release(&cons.lock);
+  return r;
+}
+
 //
 // the console input interrupt handler.
 // uartintr() calls this for each input character.
@@ -176,6 +202,7 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        pollwake(&cons.pollq);
       }
     }
     break;
@@ -195,4 +222,5 @@ consoleinit(void)
   // to consoleread and consolewrite.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].poll = consolepoll;
 }
@@ -3,17 +3,25 @@ struct context;
 struct file;
 struct inode;
 struct pipe;
+struct pollent;
+struct pollfd;
+struct waitq;
 struct proc;
+struct group;
 struct spinlock;
 struct sleeplock;
 struct stat;
+struct diskstat;
+struct iovec;
 struct superblock;
+struct vdso;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
 
@@ -33,16 +41,31 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             fileallocate(struct file*, uint, uint);
+int             filetruncate(struct file*, uint);
+int             filegetdents(struct file*, uint64, int);
+int             filepread(struct file*, uint64, int, uint);
+int             filepwrite(struct file*, uint64, int, uint);
+int             filereadv(struct file*, struct iovec*, int);
+int             filewritev(struct file*, struct iovec*, int);
+int             filesend(struct file*, struct file*, int, int);
+int             filecntl(struct file*, int, int);
+int             filepoll(struct file*, int, struct pollent*);
 
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
+void            dirunlink(struct inode*, char*, uint);
+int             isdirempty(struct inode*);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+struct inode*   iget(uint, uint);
 void            iinit();
 void            ilock(struct inode*);
+void            ilock_shared(struct inode*);
 void            iput(struct inode*);
+void            iunreserve(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
@@ -52,9 +75,16 @@ struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
-void            itrunc(struct inode*);
+void            itrunc(struct inode*, uint);
+int             iprealloc(struct inode*, uint, uint);
 void            ireclaim(int);
 
+// futex.c
+void            futexinit(void);
+int             futexwait(uint64, int, int);
+int             futexwake(uint64, int);
+void            futextick(void);
+
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
@@ -65,26 +95,51 @@ void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            log_force(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, int, uint64, int, int);
+int             pipewrite(struct pipe*, int, uint64, int, int);
+int             pipesize(struct pipe*);
+int             pipesetsize(struct pipe*, int);
+int             pipepoll(struct pipe*, int, struct pollent*);
 
 // printf.c
 int             printf(char*, ...) __attribute__ ((format (printf, 1, 2)));
 void            panic(char*) __attribute__((noreturn));
 void            printfinit(void);
 
+// poll.c
+void            pollinit(void);
+void            pollwait(struct waitq*, struct pollent*);
+void            pollwake(struct waitq*);
+void            polltick(void);
+int             pollfiles(struct file**, struct pollfd*, int, int);
+
+// shm.c
+void            shminit(void);
+uint64          shmattach(int, int);
+int             shmdetach(pagetable_t, uint64);
+void            shmdetachall(pagetable_t);
+int             shmfork(pagetable_t, pagetable_t);
+
 // proc.c
 int             cpuid(void);
 void            kexit(int);
 int             kfork(void);
-int             growproc(int);
+int             kthread(void (*)(void), char*);
+int             kclone(uint64, uint64, uint64);
+int             kjoin(int, uint64);
+int             growproc(int, uint64*);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
+int             proc_mapframes(pagetable_t, struct proc*, uint64);
+void            groupflush(struct group*);
+uint64          usersatp(struct proc*);
+void            proc_unmapframes(pagetable_t, uint64);
 int             kkill(int);
 int             killed(struct proc*);
 void            setkilled(struct proc*);
@@ -119,8 +174,10 @@ void            pop_off(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
+void            acquiresleep_shared(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
+int             holdingsleep_any(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
 // string.c
@@ -142,6 +199,7 @@ void            syscall();
 
 // trap.c
 extern uint     ticks;
+extern struct vdso *vdso;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
@@ -156,6 +214,7 @@ int             uartgetc(void);
 
 
 // vm.c
+extern int      useasids;
 void            kvminit(void);
 void            kvminithart(void);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
@@ -184,7 +243,9 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_rwv(struct buf **, int, int);
 void            virtio_disk_intr(void);
+void            virtio_disk_stat(struct diskstat*, int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -35,6 +35,13 @@ kexec(char *path, char **argv)
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
+  // the other threads would lose their memory.
+  acquire(&p->group->lock);
+  i = p->group->ref;
+  release(&p->group->lock);
+  if(i > 1)
+    return -1;
+
   begin_op();
 
   // Open the executable file.
@@ -42,7 +49,7 @@ kexec(char *path, char **argv)
     end_op();
     return -1;
   }
-  ilock(ip);
+  ilock_shared(ip);
 
   // Read the ELF header.
   if(readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -79,7 +86,7 @@ kexec(char *path, char **argv)
   ip = 0;
 
   p = myproc();
-  uint64 oldsz = p->sz;
+  uint64 oldsz = p->group->sz;
 
   // Allocate some pages at the next page boundary.
   // Make the first inaccessible as a stack guard.
@@ -129,10 +136,14 @@ kexec(char *path, char **argv)
     
   // Commit to the user image.
   oldpagetable = p->pagetable;
+  proc_unmapframes(oldpagetable, p->trapva);
+  p->trapva = TRAPFRAME;
   p->pagetable = pagetable;
-  p->sz = sz;
+  p->group->sz = sz;
+  groupflush(p->group);  // same ASID, new page table
   p->trapframe->epc = elf.entry;  // initial program counter = ulib.c:start()
   p->trapframe->sp = sp; // initial stack pointer
+  p->trapframe->tp = USERDATA(p->trapva); // see vdso.h
   proc_freepagetable(oldpagetable, oldsz);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
@@ -3,3 +3,20 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+#define O_NONBLOCK 0x800
+
+// a non-blocking read or write that would have to wait
+// returns -EAGAIN.
+#define EAGAIN    11
+
+// fcntl() commands
+#define F_GETPIPE_SZ 1  // capacity of a pipe
+#define F_SETPIPE_SZ 2  // resize a pipe, up to MAXPIPE pages
+#define F_GETFL      3  // open mode and O_NONBLOCK
+#define F_SETFL      4  // set O_NONBLOCK
+
+// A buffer for readv() and writev().
+struct iovec {
+  void *iov_base;  // user address
+  int iov_len;     // length in bytes
+};
@@ -11,6 +11,8 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "stat.h"
+#include "fcntl.h"
+#include "poll.h"
 #include "proc.h"
 
 struct devsw devsw[NDEV];
@@ -23,6 +25,8 @@ void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  for(int i = 0; i < NFILE; i++)
+    initsleeplock(&ftable.file[i].offlock, "fileoff");
 }
 
 // Allocate a file structure.
@@ -76,6 +80,13 @@ fileclose(struct file *f)
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
   } else if(ff.type == FD_INODE || ff.type == FD_DEVICE){
+    if(ff.type == FD_INODE && ff.writable){
+      // done writing through f: don't hold blocks back
+      // for as long as some other reference lasts.
+      ilock(ff.ip);
+      iunreserve(ff.ip);
+      iunlock(ff.ip);
+    }
     begin_op();
     iput(ff.ip);
     end_op();
@@ -91,7 +102,7 @@ filestat(struct file *f, uint64 addr)
   struct stat st;
   
   if(f->type == FD_INODE || f->type == FD_DEVICE){
-    ilock(f->ip);
+    ilock_shared(f->ip);
     stati(f->ip, &st);
     iunlock(f->ip);
     if(copyout(p->pagetable, addr, (char *)&st, sizeof(st)) < 0)
@@ -101,10 +112,29 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
-// Read from file f.
-// addr is a user virtual address.
-int
-fileread(struct file *f, uint64 addr, int n)
+// Lock f's inode to read it at f->off, shared with
+// readers of other files. f->offlock keeps readers of
+// f itself, which may be in other processes or
+// threads, from using f->off at the same time; writers
+// hold the inode lock exclusively.
+static void
+ilockoff(struct file *f)
+{
+  acquiresleep(&f->offlock);
+  ilock_shared(f->ip);
+}
+
+static void
+iunlockoff(struct file *f)
+{
+  iunlock(f->ip);
+  releasesleep(&f->offlock);
+}
+
+// Read from file f to addr, which is a user virtual
+// address if user_dst is 1, a kernel address otherwise.
+static int
+readfile(struct file *f, int user_dst, uint64 addr, int n)
 {
   int r = 0;
 
@@ -112,16 +142,16 @@ fileread(struct file *f, uint64 addr, int n)
     return -1;
 
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    r = piperead(f->pipe, user_dst, addr, n, f->nonblock);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    r = devsw[f->major].read(user_dst, addr, n, f->nonblock);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+    ilockoff(f);
+    if((r = readi(f->ip, user_dst, addr, f->off, n)) > 0)
       f->off += r;
-    iunlock(f->ip);
+    iunlockoff(f);
   } else {
     panic("fileread");
   }
@@ -129,48 +159,81 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
-// Write to file f.
+// Read from file f.
 // addr is a user virtual address.
 int
-filewrite(struct file *f, uint64 addr, int n)
+fileread(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  return readfile(f, 1, addr, n);
+}
+
+// Write the cnt buffers in iov to inode ip, one after
+// another starting at *off, and advance *off.
+// The buffers are in user space if user_src is 1.
+// Returns the number of bytes written.
+static int
+writeiov(struct inode *ip, int user_src, struct iovec *iov, int cnt, uint *off)
+{
+  // write a few blocks at a time to avoid exceeding
+  // the maximum log transaction size, including
+  // i-node, two levels of indirect block, allocation
+  // blocks, and 2 blocks of slop for non-aligned writes.
+  // the buffers land next to each other in the file, so
+  // several small ones can share a transaction.
+  int max = ((MAXOPBLOCKS-1-2-2) / 2) * BSIZE;
+  int i = 0, done = 0, tot = 0;
+  int r, n1, room;
+
+  while(i < cnt){
+    begin_op();
+    ilock(ip);
+    for(room = max; i < cnt && room > 0; room -= n1){
+      n1 = iov[i].iov_len - done;
+      if(n1 > room)
+        n1 = room;
+      if((r = writei(ip, user_src, (uint64)iov[i].iov_base + done, *off, n1)) > 0){
+        *off += r;
+        tot += r;
+      }
+      if(r != n1){
+        // error from writei
+        iunlock(ip);
+        end_op();
+        return tot;
+      }
+      done += n1;
+      if(done == iov[i].iov_len){
+        i++;
+        done = 0;
+      }
+    }
+    iunlock(ip);
+    end_op();
+  }
+  return tot;
+}
+
+// Write to file f from addr, which is a user virtual
+// address if user_src is 1. nonblock is as for pipewrite().
+static int
+writefile(struct file *f, int user_src, uint64 addr, int n, int nonblock)
+{
+  int ret = 0;
+  struct iovec iov;
 
   if(f->writable == 0)
     return -1;
 
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    ret = pipewrite(f->pipe, user_src, addr, n, nonblock);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
+    ret = devsw[f->major].write(user_src, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r != n1){
-        // error from writei
-        break;
-      }
-      i += r;
-    }
-    ret = (i == n ? n : -1);
+    iov.iov_base = (void*)addr;
+    iov.iov_len = n;
+    ret = (writeiov(f->ip, user_src, &iov, 1, &f->off) == n ? n : -1);
   } else {
     panic("filewrite");
   }
@@ -178,3 +241,343 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Write to file f.
+// addr is a user virtual address.
+int
+filewrite(struct file *f, uint64 addr, int n)
+{
+  return writefile(f, 1, addr, n, f->nonblock);
+}
+
+// Copy up to n bytes from file in to file out inside
+// the kernel, a page at a time, so that the data never
+// passes through user space. Reads at off if it is not
+// -1, else at in's offset. Nothing is held while the pipe
+// or device at either end sleeps.
+// Writes to out wait even if it is O_NONBLOCK, since the
+// data has already been taken from in.
+// Returns the number of bytes copied.
+int
+filesend(struct file *out, struct file *in, int off, int n)
+{
+  char *buf;
+  int m, r, tot = 0;
+
+  if(in->readable == 0 || out->writable == 0)
+    return -1;
+  if(off != -1 && in->type != FD_INODE)
+    return -1;
+  if((buf = kalloc()) == 0)
+    return -1;
+
+  while(tot < n){
+    m = n - tot;
+    if(m > PGSIZE)
+      m = PGSIZE;
+    if(off != -1){
+      ilock_shared(in->ip);
+      r = readi(in->ip, 0, (uint64)buf, off + tot, m);
+      iunlock(in->ip);
+    } else {
+      r = readfile(in, 0, (uint64)buf, m);
+    }
+    if(r <= 0){
+      if(r < 0 && tot == 0)
+        tot = r;
+      break;
+    }
+    if(writefile(out, 0, (uint64)buf, r, 0) != r){
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    tot += r;
+    // a pipe returns what it has; don't wait for more.
+    if(r < m && in->type != FD_INODE)
+      break;
+  }
+
+  kfree(buf);
+  return tot;
+}
+
+// Get or set a property of file f.
+int
+filecntl(struct file *f, int cmd, int arg)
+{
+  switch(cmd){
+  case F_GETPIPE_SZ:
+    if(f->type != FD_PIPE)
+      return -1;
+    return pipesize(f->pipe);
+  case F_SETPIPE_SZ:
+    if(f->type != FD_PIPE)
+      return -1;
+    return pipesetsize(f->pipe, arg);
+  case F_GETFL:
+    if(f->readable && f->writable)
+      arg = O_RDWR;
+    else
+      arg = f->writable ? O_WRONLY : O_RDONLY;
+    return arg | (f->nonblock ? O_NONBLOCK : 0);
+  case F_SETFL:
+    f->nonblock = (arg & O_NONBLOCK) != 0;
+    return 0;
+  }
+  return -1;
+}
+
+// Which of events file f is ready for, along with any of
+// POLLHUP and POLLERR. If e is not 0 and f could make a
+// reader or writer wait, put e on f's wait queue.
+int
+filepoll(struct file *f, int events, struct pollent *e)
+{
+  int r;
+
+  events |= POLLHUP | POLLERR;
+  if(f->type == FD_PIPE){
+    r = pipepoll(f->pipe, f->writable, e);
+  } else if(f->type == FD_DEVICE){
+    if(f->major < 0 || f->major >= NDEV)
+      return POLLNVAL;
+    if(devsw[f->major].poll)
+      r = devsw[f->major].poll(e);
+    else
+      r = POLLIN | POLLOUT;
+  } else {
+    // reads and writes of inodes don't wait for anyone.
+    r = POLLIN | POLLOUT;
+  }
+  if(!f->readable)
+    r &= ~POLLIN;
+  if(!f->writable)
+    r &= ~POLLOUT;
+  return r & events;
+}
+
+// Read from file f at offset off, leaving f->off alone.
+// Only files have offsets.
+int
+filepread(struct file *f, uint64 addr, int n, uint off)
+{
+  int r;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  ilock_shared(f->ip);
+  r = readi(f->ip, 1, addr, off, n);
+  iunlock(f->ip);
+  return r;
+}
+
+// Write to file f at offset off, leaving f->off alone.
+int
+filepwrite(struct file *f, uint64 addr, int n, uint off)
+{
+  struct iovec iov;
+
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return writeiov(f->ip, 1, &iov, 1, &off) == n ? n : -1;
+}
+
+// Read from file f into the cnt buffers in iov, filling
+// each before going on to the next.
+// Returns the total number of bytes read.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, r = 0, tot = 0;
+
+  if(f->readable == 0)
+    return -1;
+
+  if(f->type == FD_INODE){
+    // one lock for all of it, so no write comes in between.
+    ilockoff(f);
+    for(i = 0; i < cnt; i++){
+      if((r = readi(f->ip, 1, (uint64)iov[i].iov_base, f->off, iov[i].iov_len)) > 0){
+        f->off += r;
+        tot += r;
+      }
+      if(r != iov[i].iov_len)
+        break;
+    }
+    iunlockoff(f);
+    return r < 0 && tot == 0 ? -1 : tot;
+  }
+
+  for(i = 0; i < cnt; i++){
+    if((r = fileread(f, (uint64)iov[i].iov_base, iov[i].iov_len)) < 0)
+      return tot ? tot : r;
+    tot += r;
+    if(r != iov[i].iov_len)
+      break;
+  }
+  return tot;
+}
+
+// Write the cnt buffers in iov to file f.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, n, r, tot = 0;
+
+  if(f->writable == 0)
+    return -1;
+
+  if(f->type == FD_INODE){
+    for(i = n = 0; i < cnt; i++)
+      n += iov[i].iov_len;
+    return writeiov(f->ip, 1, iov, cnt, &f->off) == n ? n : -1;
+  }
+
+  for(i = 0; i < cnt; i++){
+    if((r = filewrite(f, (uint64)iov[i].iov_base, iov[i].iov_len)) < 0)
+      return tot ? tot : r;
+    tot += r;
+    // a non-blocking pipe may take only part of it.
+    if(r != iov[i].iov_len)
+      break;
+  }
+  return tot;
+}
+
+// Allocate blocks for bytes [off, off+n) of file f,
+// growing it if necessary. A gap between the end of
+// the file and off is filled in too.
+int
+fileallocate(struct file *f, uint off, uint n)
+{
+  // as in filewrite(), a few blocks per transaction.
+  int max = ((MAXOPBLOCKS-1-2-2) / 2) * BSIZE;
+  uint end, n1;
+  int r;
+
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  end = off + n;
+  if(end < off || end > MAXFILE*BSIZE)
+    return -1;
+
+  r = 0;
+  while(off < end && r == 0){
+    begin_op();
+    ilock(f->ip);
+    if(off > f->ip->size)
+      off = f->ip->size;
+    n1 = end - off;
+    if(n1 > max)
+      n1 = max;
+    r = iprealloc(f->ip, off, n1);
+    iunlock(f->ip);
+    end_op();
+    off += n1;
+  }
+  return r;
+}
+
+// Set the length of file f to n bytes, discarding
+// what lies beyond n or growing it with zeros.
+int
+filetruncate(struct file *f, uint n)
+{
+  // free at most an indirect block's worth of data
+  // per transaction.
+  uint step = NINDIRECT*BSIZE;
+  uint size, n1;
+
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+
+  for(;;){
+    begin_op();
+    ilock(f->ip);
+    size = f->ip->size;
+    if(n < size){
+      n1 = n;
+      if(size - n > step && (size - step) / BSIZE * BSIZE > n)
+        n1 = (size - step) / BSIZE * BSIZE;
+      itrunc(f->ip, n1);
+      size = n1;
+    }
+    iunlock(f->ip);
+    end_op();
+    if(size <= n)
+      break;
+  }
+
+  if(n > size)
+    return fileallocate(f, size, n - size);
+  return 0;
+}
+
+// Read entries from directory f into the array of struct
+// dirstat at user address addr, which has room for n bytes.
+// Returns the number of bytes read, 0 at the end of the
+// directory, or -1.
+int
+filegetdents(struct file *f, uint64 addr, int n)
+{
+  enum { BATCH = 8 };
+  struct proc *p = myproc();
+  struct inode *dp = f->ip, *ips[BATCH];
+  char names[BATCH][DIRSIZ];
+  struct dirent de;
+  struct dirstat ds;
+  int i, cnt, tot, err;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+
+  tot = 0;
+  err = 0;
+  while(!err && tot + sizeof(ds) <= n){
+    begin_op();
+
+    // take a reference to each of a few entries' inodes, so
+    // that they stay put after dp is unlocked. locking them
+    // with dp locked could deadlock, as ".." is dp's parent.
+    ilock(dp);
+    if(dp->type != T_DIR){
+      iunlock(dp);
+      end_op();
+      return -1;
+    }
+    cnt = 0;
+    while(cnt < BATCH && tot + (cnt+1)*sizeof(ds) <= n && f->off < dp->size){
+      if(readi(dp, 0, (uint64)&de, f->off, sizeof(de)) != sizeof(de))
+        panic("getdents");
+      f->off += sizeof(de);
+      if(de.inum){
+        ips[cnt] = iget(dp->dev, de.inum);
+        memmove(names[cnt], de.name, DIRSIZ);
+        cnt++;
+      }
+    }
+    iunlock(dp);
+
+    for(i = 0; i < cnt; i++){
+      memset(&ds, 0, sizeof(ds));
+      memmove(ds.name, names[i], DIRSIZ);
+      ilock_shared(ips[i]);
+      ds.size = ips[i]->size;
+      ds.inum = ips[i]->inum;
+      ds.type = ips[i]->type;
+      iunlock(ips[i]);
+      iput(ips[i]);
+      if(!err && copyout(p->pagetable, addr + tot, (char*)&ds, sizeof(ds)) < 0)
+        err = 1;
+      tot += sizeof(ds);
+    }
+    end_op();
+
+    if(cnt == 0)
+      break;
+  }
+  return err ? -1 : tot;
+}
+
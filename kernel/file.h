@@ -3,9 +3,11 @@ struct file {
   int ref; // reference count
   char readable;
   char writable;
+  char nonblock;     // O_NONBLOCK
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
+  struct sleeplock offlock; // held to read and advance off
   short major;       // FD_DEVICE
 };
 
@@ -18,6 +20,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // itable hash chain
+  struct inode *prev; // LRU list of unreferenced inodes
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,13 +31,30 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+
+  uint goal;          // where to allocate the next block
+  uint pre;           // first block reserved for this file
+  int npre;           // number of blocks reserved
+};
+
+// processes waiting in poll() for an object.
+struct waitq {
+  struct pollent *head;
+};
+
+// a poll() caller's place on a waitq.
+struct pollent {
+  int *ready;           // set by pollwake(); the sleep channel
+  struct waitq *q;      // queue this entry is on, or 0
+  struct pollent *next;
 };
 
 // map major device number to device functions.
 struct devsw {
-  int (*read)(int, uint64, int);
+  int (*read)(int, uint64, int, int);
   int (*write)(int, uint64, int);
+  int (*poll)(struct pollent*);
 };
 
 extern struct devsw devsw[];
@@ -26,6 +26,10 @@
 // only one device
 struct superblock sb; 
 
+static void fmapinit(int);
+static void dcinit(void);
+static void dcpurge(uint, uint);
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -44,6 +48,7 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  fmapinit(dev);
   ireclaim(dev);
 }
 
@@ -60,32 +65,153 @@ bzero(int dev, int bno)
 }
 
 // Blocks.
+//
+// The bitmap on disk records which blocks are in use, and
+// every change to it goes through the log. fmap mirrors it
+// in memory so that allocation can search for free blocks
+// without reading bitmap blocks. A bit is also set in fmap
+// for a block that is reserved for an inode but not yet
+// allocated on disk. nfree[] counts the clear bits in each
+// bitmap block's range, so searches can skip full ranges.
 
-// Allocate a zeroed disk block.
-// returns 0 if out of disk space.
-static uint
-balloc(uint dev)
+struct {
+  struct spinlock lock;
+  uchar map[FSSIZE/8 + 1];
+  uint nfree[FSSIZE/BPB + 1];
+  uint next;  // where to search when an inode has no goal
+} fmap;
+
+// Load fmap from the bitmap. Called after log recovery.
+static void
+fmapinit(int dev)
 {
-  int b, bi, m;
   struct buf *bp;
+  int b, bi;
 
-  bp = 0;
+  if(sb.size > FSSIZE)
+    panic("fmapinit: file system too big");
+  initlock(&fmap.lock, "fmap");
   for(b = 0; b < sb.size; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
     for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+      if(bp->data[bi/8] & (1 << (bi % 8)))
+        fmap.map[(b + bi)/8] |= 1 << (bi % 8);
+      else
+        fmap.nfree[b/BPB]++;
     }
     brelse(bp);
   }
-  printf("balloc: out of blocks\n");
-  return 0;
+  fmap.next = sb.size - sb.nblocks;
+}
+
+// Reserve a run of up to n free blocks, starting with the
+// first free block at or after goal (wrapping around).
+// Returns the first block and sets *np to the run's length,
+// which is 0 if the disk is full.
+static uint
+reserve(uint goal, int n, int *np)
+{
+  uint b, start, scanned, step;
+  int len;
+
+  acquire(&fmap.lock);
+  if(goal == 0 || goal >= sb.size)
+    goal = fmap.next;
+  b = goal;
+  start = 0;
+  for(scanned = 0; scanned < sb.size + BPB; scanned += step){
+    if(fmap.nfree[b/BPB] == 0)
+      step = BPB - b%BPB;
+    else if(fmap.map[b/8] == 0xff)
+      step = 8 - b%8;
+    else if((fmap.map[b/8] & (1 << (b%8))) == 0){
+      start = b;
+      break;
+    } else
+      step = 1;
+    b += step;
+    if(b >= sb.size)
+      b = 0;
+  }
+
+  len = 0;
+  if(start){
+    for(b = start; len < n && b < sb.size; b++, len++){
+      if(fmap.map[b/8] & (1 << (b%8)))
+        break;
+      fmap.map[b/8] |= 1 << (b%8);
+      fmap.nfree[b/BPB]--;
+    }
+    fmap.next = b;
+  }
+  release(&fmap.lock);
+  *np = len;
+  return start;
+}
+
+// Give back n reserved blocks starting at b, or
+// record in fmap that they have been freed.
+static void
+unreserve(uint b, int n)
+{
+  acquire(&fmap.lock);
+  for(; n > 0; b++, n--){
+    if((fmap.map[b/8] & (1 << (b%8))) == 0)
+      panic("unreserve");
+    fmap.map[b/8] &= ~(1 << (b%8));
+    fmap.nfree[b/BPB]++;
+  }
+  release(&fmap.lock);
+}
+
+// Give back the blocks reserved for ip but not
+// yet allocated to it.
+// Caller must hold ip->lock, or the only reference.
+void
+iunreserve(struct inode *ip)
+{
+  if(ip->npre > 0){
+    unreserve(ip->pre, ip->npre);
+    ip->npre = 0;
+  }
+}
+
+// Allocate a zeroed disk block for inode ip.
+// Blocks come from a run of up to NPREALLOC blocks
+// reserved for ip just past the last block allocated to
+// it, so that files written at the same time don't
+// interleave their blocks on disk. Directories grow a
+// block at a time and stay referenced (as a cwd, say)
+// for a long time, so they reserve no more than they use.
+// returns 0 if out of disk space.
+static uint
+balloc(struct inode *ip)
+{
+  uint b;
+  int bi, m;
+  struct buf *bp;
+
+  if(ip->npre == 0){
+    ip->pre = reserve(ip->goal, ip->type == T_DIR ? 1 : NPREALLOC, &ip->npre);
+    if(ip->npre == 0){
+      printf("balloc: out of blocks\n");
+      return 0;
+    }
+  }
+  b = ip->pre++;
+  ip->npre--;
+  ip->goal = b + 1;
+
+  bp = bread(ip->dev, BBLOCK(b, sb));
+  bi = b % BPB;
+  m = 1 << (bi % 8);
+  if(bp->data[bi/8] & m)
+    panic("balloc: block in use");
+  bp->data[bi/8] |= m;  // Mark block in use.
+  log_write(bp);
+  brelse(bp);
+  bzero(ip->dev, b);
+  return b;
 }
 
 // Free a disk block.
@@ -103,6 +229,7 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+  unreserve(b, 1);
 }
 
 // Inodes.
@@ -130,18 +257,18 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a table entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in table: ip->ref tracks the number of
+//   in-memory pointers to the entry (open files and current
+//   directories). iget() finds or creates a table entry and
+//   increments its ref; iput() decrements ref. An entry
+//   whose ref is zero stays in the table, on an LRU list,
+//   until iget() recycles it for another inode.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
-//   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ilock() reads the inode from the disk and sets
+//   ip->valid, while iget() clears ip->valid when it
+//   recycles an entry and iput() when it frees the inode.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -165,32 +292,69 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
+// Code that only looks at an inode and reads its content,
+// such as read() and path name lookup, can use ilock_shared()
+// instead, so that it does not wait for other readers.
+//
+// The table finds entries through a hash table on (dev, inum).
+// It starts empty and allocates entries a page at a time,
+// until it holds NINODE. After that, iget() recycles the least
+// recently used entry whose ref is zero, and allocates more only
+// if every entry is in use.
+//
 // The itable.lock spin-lock protects the allocation of itable
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// holds, one must hold itable.lock while using any of those
+// fields, or the hash and LRU links.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 61
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];  // chains through ip->hnext
+  int n;                       // number of entries
+
+  // Linked list of entries with ref == 0, through prev/next.
+  // lru.next is the most recently used, lru.prev the least.
+  struct inode lru;
 } itable;
 
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  itable.lru.prev = &itable.lru;
+  itable.lru.next = &itable.lru;
+  dcinit();
 }
 
-static struct inode* iget(uint dev, uint inum);
+// Add a page of new entries to the end of the LRU list.
+// Caller must hold itable.lock.
+static void
+igrow(void)
+{
+  struct inode *ip, *end;
+  char *mem;
+
+  if((mem = kalloc()) == 0)
+    return;
+  memset(mem, 0, PGSIZE);
+  end = (struct inode*)mem + PGSIZE/sizeof(struct inode);
+  for(ip = (struct inode*)mem; ip < end; ip++){
+    initsleeplock(&ip->lock, "inode");
+    ip->next = &itable.lru;
+    ip->prev = itable.lru.prev;
+    itable.lru.prev->next = ip;
+    itable.lru.prev = ip;
+    itable.n++;
+  }
+}
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
@@ -244,34 +408,46 @@ iupdate(struct inode *ip)
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
-static struct inode*
+struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = itable.hash[IHASH(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0){
+        ip->next->prev = ip->prev;
+        ip->prev->next = ip->next;
+      }
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
+  // Recycle the least recently used entry.
+  if(itable.n < NINODE || itable.lru.prev == &itable.lru)
+    igrow();
+  ip = itable.lru.prev;
+  if(ip == &itable.lru)
     panic("iget: no inodes");
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+  if(ip->inum){
+    for(pp = &itable.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->goal = 0;
+  ip->hnext = itable.hash[IHASH(dev, inum)];
+  itable.hash[IHASH(dev, inum)] = ip;
   release(&itable.lock);
 
   return ip;
@@ -317,11 +493,32 @@ ilock(struct inode *ip)
   }
 }
 
-// Unlock the given inode.
+// Lock the given inode for reading, shared with other
+// readers. The holder may look at the inode and read its
+// content, but must not change either.
+void
+ilock_shared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilock_shared");
+
+  acquiresleep_shared(&ip->lock);
+  if(ip->valid == 0){
+    // read it from disk under the exclusive lock. it
+    // stays valid while the caller holds a reference.
+    releasesleep(&ip->lock);
+    ilock(ip);
+    releasesleep(&ip->lock);
+    acquiresleep_shared(&ip->lock);
+  }
+}
+
+// Unlock the given inode, whether
+// locked exclusively or shared.
 void
 iunlock(struct inode *ip)
 {
-  if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
+  if(ip == 0 || !holdingsleep_any(&ip->lock) || ip->ref < 1)
     panic("iunlock");
 
   releasesleep(&ip->lock);
@@ -329,7 +526,7 @@ iunlock(struct inode *ip)
 
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode table entry can
-// be recycled.
+// be recycled, though it stays cached until it is.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -348,7 +545,9 @@ iput(struct inode *ip)
 
     release(&itable.lock);
 
-    itrunc(ip);
+    if(ip->type == T_DIR)
+      dcpurge(ip->dev, ip->inum);
+    itrunc(ip, 0);
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
@@ -358,7 +557,18 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(ip->ref == 1){
+    // last reference: no one else holds ip->lock.
+    iunreserve(ip);
+  }
+
+  if(--ip->ref == 0){
+    // keep it cached, as the most recently used.
+    ip->next = itable.lru.next;
+    ip->prev = &itable.lru;
+    itable.lru.next->prev = ip;
+    itable.lru.next = ip;
+  }
   release(&itable.lock);
 }
 
@@ -397,7 +607,37 @@ ireclaim(int dev)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The last NDINDIRECT
+// are listed in the NINDIRECT blocks that are listed in
+// block ip->addrs[NDIRECT+1].
+
+// Return the address of entry i of indirect block *ap,
+// allocating the indirect block and the entry's block
+// as necessary. returns 0 if out of disk space.
+static uint
+indirect(struct inode *ip, uint *ap, uint i)
+{
+  uint addr, *a;
+  struct buf *bp;
+
+  if((addr = *ap) == 0){
+    addr = balloc(ip);
+    if(addr == 0)
+      return 0;
+    *ap = addr;
+  }
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0){
+    addr = balloc(ip);
+    if(addr){
+      a[i] = addr;
+      log_write(bp);
+    }
+  }
+  brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
@@ -405,12 +645,11 @@ ireclaim(int dev)
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = balloc(ip);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
@@ -421,60 +660,129 @@ bmap(struct inode *ip, uint bn)
 
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
-    }
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr){
-        a[bn] = addr;
-        log_write(bp);
-      }
-    }
-    brelse(bp);
-    return addr;
+    return indirect(ip, &ip->addrs[NDIRECT], bn);
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Find the indirect block in the double-indirect
+    // block, then the data block in that.
+    if((addr = indirect(ip, &ip->addrs[NDIRECT+1], bn / NINDIRECT)) == 0)
+      return 0;
+    return indirect(ip, &addr, bn % NINDIRECT);
   }
 
   panic("bmap: out of range");
 }
 
-// Truncate inode (discard contents).
+// Free the blocks listed in indirect block *ap from entry
+// first/span on, where span is the number of file blocks
+// under each entry (1, or NINDIRECT if depth > 1, when the
+// entries are themselves indirect blocks). first counts
+// file blocks from the start of *ap's range. If first is 0,
+// free *ap itself too and clear *ap.
+static void
+ifree(uint dev, uint *ap, int depth, uint first)
+{
+  int j, dirty;
+  uint span, *a;
+  struct buf *bp;
+
+  span = depth > 1 ? NINDIRECT : 1;
+  bp = bread(dev, *ap);
+  a = (uint*)bp->data;
+  dirty = 0;
+  for(j = first / span; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 1)
+      ifree(dev, &a[j], depth-1, j == first/span ? first%span : 0);
+    else {
+      bfree(dev, a[j]);
+      a[j] = 0;
+    }
+    dirty = 1;
+  }
+  if(first == 0){
+    brelse(bp);
+    bfree(dev, *ap);
+    *ap = 0;
+    return;
+  }
+  if(dirty)
+    log_write(bp);
+  brelse(bp);
+}
+
+// Truncate inode to n bytes, discarding the rest of
+// its contents. n must not exceed ip->size.
 // Caller must hold ip->lock.
 void
-itrunc(struct inode *ip)
+itrunc(struct inode *ip, uint n)
 {
-  int i, j;
+  uint i, nb;
   struct buf *bp;
-  uint *a;
 
-  for(i = 0; i < NDIRECT; i++){
+  nb = (n + BSIZE - 1) / BSIZE;  // blocks to keep
+
+  for(i = nb; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
       ip->addrs[i] = 0;
     }
   }
+  nb = nb > NDIRECT ? nb - NDIRECT : 0;
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
+  if(ip->addrs[NDIRECT] && nb < NINDIRECT)
+    ifree(ip->dev, &ip->addrs[NDIRECT], 1, nb);
+  nb = nb > NINDIRECT ? nb - NINDIRECT : 0;
+
+  if(ip->addrs[NDIRECT+1])
+    ifree(ip->dev, &ip->addrs[NDIRECT+1], 2, nb);
+
+  // zero the rest of the last block, so that the file
+  // reads as zeros there if it grows again.
+  if(n % BSIZE){
+    bp = bread(ip->dev, bmap(ip, n / BSIZE));
+    memset(bp->data + n % BSIZE, 0, BSIZE - n % BSIZE);
+    log_write(bp);
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
 
-  ip->size = 0;
+  ip->size = n;
   iupdate(ip);
 }
 
+// Allocate the blocks holding bytes [off, off+n) of ip,
+// and grow ip->size to off+n if it is smaller. off must
+// not be past the end of the file, so that the file has
+// no holes. New blocks are zero.
+// Caller must hold ip->lock, in a transaction with room
+// for the blocks.
+// Returns 0, or -1 if out of range or out of disk space.
+int
+iprealloc(struct inode *ip, uint off, uint n)
+{
+  uint bn;
+
+  if(off > ip->size || off + n < off || off + n > MAXFILE*BSIZE)
+    return -1;
+
+  for(bn = off / BSIZE; bn * BSIZE < off + n; bn++){
+    if(bmap(ip, bn) == 0){
+      // out of disk space. leave the size alone;
+      // itrunc() frees the blocks past it.
+      iupdate(ip);
+      return -1;
+    }
+  }
+
+  if(off + n > ip->size)
+    ip->size = off + n;
+  iupdate(ip);
+  return 0;
+}
+
 // Copy stat information from inode.
 // Caller must hold ip->lock.
 void
@@ -569,17 +877,447 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory entry cache.
+//
+// The dcache remembers the results of dirlookup(): which
+// inode a name in a directory refers to and where its entry
+// is, or that the name is not there (inum == 0). Entries are
+// found through a hash on (dev, dir, name) and recycled in
+// LRU order.
+//
+// Callers hold the directory's lock. A directory's contents
+// only change while it is locked exclusively, and dirlink(),
+// dirunlink() and dirsplit() update its cache entries then, so the entries
+// always match what is on disk. Freeing a directory inode
+// drops its entries, since its inum may be reused.
+
+#define NDHASH 61
+
+struct dentry {
+  uint dev;
+  uint dir;             // inum of the directory
+  char name[DIRSIZ];
+  uint inum;            // 0 if name is not in dir
+  uint off;             // byte offset of dir's entry for name
+  struct dentry *hnext; // hash chain
+  struct dentry *prev;  // LRU list
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry dentry[NDENTRY];
+  struct dentry *hash[NDHASH];
+
+  // Linked list of all entries, through prev/next.
+  // lru.next is the most recently used, lru.prev the least.
+  struct dentry lru;
+} dcache;
+
+static void
+dcinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.lru.prev = &dcache.lru;
+  dcache.lru.next = &dcache.lru;
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++){
+    d->next = dcache.lru.next;
+    d->prev = &dcache.lru;
+    dcache.lru.next->prev = d;
+    dcache.lru.next = d;
+  }
+}
+
+static uint
+dchash(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDHASH;
+}
+
+// Find the entry for name in dir, and move it to the
+// front of the LRU list. Caller must hold dcache.lock.
+static struct dentry*
+dcfind(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.hash[dchash(dev, dir, name)]; d; d = d->hnext){
+    if(d->dev == dev && d->dir == dir && namecmp(d->name, name) == 0){
+      d->next->prev = d->prev;
+      d->prev->next = d->next;
+      d->next = dcache.lru.next;
+      d->prev = &dcache.lru;
+      dcache.lru.next->prev = d;
+      dcache.lru.next = d;
+      return d;
+    }
+  }
+  return 0;
+}
+
+// Take d out of its hash chain. Caller must hold dcache.lock.
+static void
+dcunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.hash[dchash(d->dev, d->dir, d->name)]; *pp != d; pp = &(*pp)->hnext)
+    ;
+  *pp = d->hnext;
+  d->dir = 0;
+}
+
+// Record that name in directory dp refers to inode inum,
+// with its entry at byte offset off, or that it is not
+// there if inum is 0. Caller must hold dp->lock.
+static void
+dcenter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dp->dev, dp->inum, name)) == 0){
+    // Recycle the least recently used entry.
+    d = dcache.lru.prev;
+    if(d->dir)
+      dcunhash(d);
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    d->hnext = dcache.hash[dchash(d->dev, d->dir, d->name)];
+    dcache.hash[dchash(d->dev, d->dir, d->name)] = d;
+    d->next->prev = d->prev;
+    d->prev->next = d->next;
+    d->next = dcache.lru.next;
+    d->prev = &dcache.lru;
+    dcache.lru.next->prev = d;
+    dcache.lru.next = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  release(&dcache.lock);
+}
+
+// Drop the entries for directory dir, which is being freed.
+static void
+dcpurge(uint dev, uint dir)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++){
+    if(d->dir == dir && d->dev == dev)
+      dcunhash(d);
+  }
+  release(&dcache.lock);
+}
+
+// Hashed directories. See the comment above struct dirhead.
+
+#define NBUCKET(dp) ((dp)->size / BSIZE - 1)
+
+// Read hashed directory dp's header into *hd.
+// Returns 0 if dp is linear.
+static int
+readhead(struct inode *dp, struct dirhead *hd)
+{
+  if(dp->size <= DIRLINEAR*BSIZE)
+    return 0;
+  if(readi(dp, 0, (uint64)hd, 2*sizeof(struct dirent), sizeof(*hd)) != sizeof(*hd) ||
+     memcmp(hd->magic, DIRMAGIC, 2) != 0)
+    panic("readhead");
+  return 1;
+}
+
+static void
+writehead(struct inode *dp, struct dirhead *hd)
+{
+  if(writei(dp, 0, (uint64)hd, 2*sizeof(struct dirent), sizeof(*hd)) != sizeof(*hd))
+    panic("writehead");
+}
+
+// Search bucket b of hashed directory dp for the entry for
+// name. Returns the entry's byte offset and sets *inum, or
+// returns -1. Sets *passed if entries have gone past b.
+static int
+bucketfind(struct inode *dp, uint b, char *name, uint *inum, int *passed)
+{
+  struct buf *bp;
+  struct dirent *de, *d0;
+  int off;
+
+  off = -1;
+  bp = bread(dp->dev, bmap(dp, 1 + b));
+  d0 = (struct dirent*)bp->data;
+  for(de = d0 + 1; de < d0 + DPB; de++){
+    if(de->inum && namecmp(name, de->name) == 0){
+      off = (1 + b) * BSIZE + (de - d0) * sizeof(*de);
+      *inum = de->inum;
+      break;
+    }
+  }
+  *passed = ((struct dirhead*)d0)->passed;
+  brelse(bp);
+  return off;
+}
+
+// Look for name in hashed directory dp. Returns the byte
+// offset of its entry and sets *inum, or returns -1.
+static int
+hashlookup(struct inode *dp, char *name, uint *inum)
+{
+  uint b, i, n;
+  int off, passed;
+
+  n = NBUCKET(dp);
+  b = dirbucket(dirhash(name), n);
+  for(i = 0; i < n; i++, b = (b + 1) % n){
+    if((off = bucketfind(dp, b, name, inum, &passed)) >= 0)
+      return off;
+    if(!passed)
+      break;
+  }
+  return -1;
+}
+
+// Put entry *de in bucket b of hashed directory dp, or in
+// the first bucket after b with room, marking the full ones.
+// Returns the entry's byte offset, or -1 if all are full.
+static int
+hashplace(struct inode *dp, uint b, struct dirent *de)
+{
+  uint i, n;
+  int off;
+  struct buf *bp;
+  struct dirent *d, *d0;
+  struct dirhead *h;
+
+  off = -1;
+  n = NBUCKET(dp);
+  for(i = 0; i < n && off < 0; i++, b = (b + 1) % n){
+    bp = bread(dp->dev, bmap(dp, 1 + b));
+    d0 = (struct dirent*)bp->data;
+    for(d = d0 + 1; d < d0 + DPB; d++){
+      if(d->inum == 0){
+        *d = *de;
+        off = (1 + b) * BSIZE + (d - d0) * sizeof(*d);
+        log_write(bp);
+        break;
+      }
+    }
+    h = (struct dirhead*)d0;
+    if(off < 0 && !h->passed){
+      h->passed = 1;
+      log_write(bp);
+    }
+    brelse(bp);
+  }
+  if(off >= 0)
+    dcenter(dp, de->name, de->inum, off);
+  return off;
+}
+
+// Add a bucket to hashed directory dp by splitting the next
+// bucket in turn, and move the entries that now belong in
+// the new bucket. Returns -1 if out of memory or disk space.
+static int
+dirsplit(struct inode *dp)
+{
+  uint b, i, k, m, n, nmove;
+  int passed;
+  struct buf *bp;
+  struct dirent *d, *d0, *move;
+  struct dirhead *h;
+
+  n = NBUCKET(dp);
+  for(m = 1; m * 2 <= n; m *= 2)
+    ;
+  if((move = (struct dirent*)kalloc()) == 0)
+    return -1;
+  if(bmap(dp, 1 + n) == 0){
+    kfree(move);
+    return -1;
+  }
+
+  // the new bucket n comes between n-1 and 0 when probing,
+  // so it must pass lookups on if n-1 does.
+  bp = bread(dp->dev, bmap(dp, n));
+  passed = ((struct dirhead*)bp->data)->passed;
+  brelse(bp);
+  bp = bread(dp->dev, bmap(dp, 1 + n));
+  h = (struct dirhead*)bp->data;
+  memmove(h->magic, DIRMAGIC, 2);
+  h->passed = passed;
+  log_write(bp);
+  brelse(bp);
+  dp->size += BSIZE;
+  iupdate(dp);
+
+  // bucket n - m splits into itself and bucket n. move the
+  // entries that belong in n now, from n - m and from the
+  // buckets that its entries went on to.
+  b = n - m;
+  for(i = 0; i < n; i++, b = (b + 1) % n){
+    bp = bread(dp->dev, bmap(dp, 1 + b));
+    d0 = (struct dirent*)bp->data;
+    nmove = 0;
+    for(d = d0 + 1; d < d0 + DPB; d++){
+      if(d->inum && dirbucket(dirhash(d->name), n + 1) == n){
+        move[nmove++] = *d;
+        memset(d, 0, sizeof(*d));
+      }
+    }
+    passed = ((struct dirhead*)d0)->passed;
+    if(nmove)
+      log_write(bp);
+    brelse(bp);
+    for(k = 0; k < nmove; k++){
+      if(hashplace(dp, n, &move[k]) < 0)
+        panic("dirsplit");
+    }
+    if(!passed)
+      break;
+  }
+  kfree(move);
+  return 0;
+}
+
+// Add the entry (name, inum) to hashed directory dp,
+// first growing it if it is half full. Buckets that have
+// not been split yet hold twice as many entries as those
+// that have, and must rarely fill up, since the marks on
+// full buckets are never cleared.
+static int
+hashinsert(struct inode *dp, struct dirhead *hd, char *name, uint inum)
+{
+  struct dirent de;
+
+  // if the split fails there may still be room.
+  if(hd->nent + 1 > NBUCKET(dp) * (DPB-1) / 2)
+    dirsplit(dp);
+
+  strncpy(de.name, name, DIRSIZ);
+  de.inum = inum;
+  if(hashplace(dp, dirbucket(dirhash(name), NBUCKET(dp)), &de) < 0)
+    return -1;
+  hd->nent++;
+  writehead(dp, hd);
+  return 0;
+}
+
+// Turn linear directory dp, whose DIRLINEAR blocks are full,
+// into a hashed directory, and fill in *hd.
+// Returns -1 if out of memory or disk space.
+static int
+dirconvert(struct inode *dp, struct dirhead *hd)
+{
+  struct dirent *ents;
+  struct dirhead *h;
+  struct buf *bp;
+  uint i, n;
+
+  if(DIRLINEAR*BSIZE > PGSIZE || (ents = (struct dirent*)kalloc()) == 0)
+    return -1;
+  if(readi(dp, 0, (uint64)ents, 0, DIRLINEAR*BSIZE) != DIRLINEAR*BSIZE)
+    panic("dirconvert read");
+
+  // allocate the new blocks before changing anything; if that
+  // fails, dp stays linear, and itrunc() frees them.
+  n = DIRLINEAR + 1;  // buckets
+  for(i = DIRLINEAR; i <= n; i++){
+    if(bmap(dp, i) == 0){
+      kfree(ents);
+      return -1;
+    }
+  }
+
+  memset(hd, 0, sizeof(*hd));
+  memmove(hd->magic, DIRMAGIC, 2);
+  for(i = 0; i <= n; i++){
+    bp = bread(dp->dev, bmap(dp, i));
+    memset(bp->data, 0, BSIZE);
+    if(i == 0){
+      // "." and ".." stay where they are.
+      memmove(bp->data, ents, 2*sizeof(struct dirent));
+      memmove(bp->data + 2*sizeof(struct dirent), hd, sizeof(*hd));
+    } else {
+      h = (struct dirhead*)bp->data;
+      memmove(h->magic, DIRMAGIC, 2);
+    }
+    log_write(bp);
+    brelse(bp);
+  }
+  dp->size = (1 + n) * BSIZE;
+  iupdate(dp);
+
+  for(i = 2; i < DIRLINEAR*DPB; i++){
+    if(ents[i].inum && hashinsert(dp, hd, ents[i].name, ents[i].inum) < 0)
+      panic("dirconvert");
+  }
+  kfree(ents);
+  return 0;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
+  int hoff;
   struct dirent de;
+  struct dentry *d;
+  struct dirhead hd;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  acquire(&dcache.lock);
+  if((d = dcfind(dp->dev, dp->inum, name)) != 0){
+    inum = d->inum;
+    off = d->off;
+    release(&dcache.lock);
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+  release(&dcache.lock);
+
+  // "." and ".." are the first two entries, also in a
+  // hashed directory, whose buckets don't hold them.
+  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0){
+    off = name[1] ? sizeof(de) : 0;
+    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+      panic("dirlookup read");
+    if(de.inum && namecmp(name, de.name) == 0){
+      if(poff)
+        *poff = off;
+      dcenter(dp, name, de.inum, off);
+      return iget(dp->dev, de.inum);
+    }
+  }
+
+  if(readhead(dp, &hd)){
+    if((hoff = hashlookup(dp, name, &inum)) < 0){
+      dcenter(dp, name, 0, 0);
+      return 0;
+    }
+    if(poff)
+      *poff = hoff;
+    dcenter(dp, name, inum, hoff);
+    return iget(dp->dev, inum);
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -590,10 +1328,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcenter(dp, name, inum, off);
       return iget(dp->dev, inum);
     }
   }
 
+  dcenter(dp, name, 0, 0);
   return 0;
 }
 
@@ -604,6 +1344,7 @@ dirlink(struct inode *dp, char *name, uint inum)
 {
   int off;
   struct dirent de;
+  struct dirhead hd;
   struct inode *ip;
 
   // Check that name is not present.
@@ -612,6 +1353,9 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
+  if(readhead(dp, &hd))
+    return hashinsert(dp, &hd, name, inum);
+
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
@@ -620,14 +1364,60 @@ dirlink(struct inode *dp, char *name, uint inum)
       break;
   }
 
+  if(off >= DIRLINEAR*BSIZE){
+    // too big to search linearly.
+    if(dirconvert(dp, &hd) < 0)
+      return -1;
+    return hashinsert(dp, &hd, name, inum);
+  }
+
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
+  dcenter(dp, name, inum, off);
 
   return 0;
 }
 
+// Remove the entry for name, at byte offset off, from
+// directory dp.
+void
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  struct dirent de;
+  struct dirhead hd;
+
+  memset(&de, 0, sizeof(de));
+  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    panic("unlink: writei");
+  dcenter(dp, name, 0, 0);
+  if(readhead(dp, &hd)){
+    hd.nent--;
+    writehead(dp, &hd);
+  }
+}
+
+// Is the directory dp empty except for "." and ".." ?
+int
+isdirempty(struct inode *dp)
+{
+  int off;
+  struct dirent de;
+  struct dirhead hd;
+
+  if(readhead(dp, &hd))
+    return hd.nent == 0;
+
+  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
+    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+      panic("isdirempty: readi");
+    if(de.inum != 0)
+      return 0;
+  }
+  return 1;
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -678,11 +1468,14 @@ namex(char *path, int nameiparent, char *name)
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
-  else
-    ip = idup(myproc()->cwd);
+  else {
+    acquire(&myproc()->group->lock);
+    ip = idup(myproc()->group->cwd);
+    release(&myproc()->group->lock);
+  }
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    ilock_shared(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
       return 0;
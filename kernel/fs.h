@@ -24,9 +24,10 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -35,7 +36,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
 // Inodes per block.
@@ -60,3 +61,60 @@ struct dirent {
   char name[DIRSIZ] __attribute__((nonstring));
 };
 
+// An entry as getdents() returns it: the name, with a NUL,
+// and what stat() would say about the inode it names.
+struct dirstat {
+  uint64 size;
+  uint inum;
+  short type;
+  char name[DIRSIZ+1];
+};
+
+// Entries per directory block.
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// A directory of up to DIRLINEAR blocks is searched linearly.
+// A bigger one is a hash table: block 0 holds ".", ".." and a
+// dirhead in place of the third entry, and each block after
+// that is a bucket, whose first entry is also a dirhead. A
+// name belongs in bucket dirbucket(dirhash(name), n) of n, and
+// the table grows a bucket at a time by splitting one (linear
+// hashing). An entry whose bucket is full goes in the next one
+// with room, and the buckets it passes are marked, so that
+// lookups know to keep looking.
+#define DIRLINEAR     1
+
+struct dirhead {
+  ushort inum;     // 0, so that the header reads as a free entry
+  uchar magic[2];  // DIRMAGIC; a name never starts with 0
+  uint nent;       // in block 0: number of entries in the buckets
+  uint passed;     // in a bucket: entries have gone past it
+  uint pad;
+};
+
+#define DIRMAGIC      "\0H"
+
+static inline uint
+dirhash(const char *name)
+{
+  uint h = 2166136261;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (unsigned char)name[i]) * 16777619;
+  return h;
+}
+
+// Bucket of hash h in a table of n buckets.
+static inline uint
+dirbucket(uint h, uint n)
+{
+  uint m;
+
+  for(m = 1; m * 2 <= n; m *= 2)
+    ;
+  if(h % m < n - m)
+    return h % (2 * m);
+  return h % m;
+}
+
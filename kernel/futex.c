@@ -0,0 +1,132 @@
+//
+// Futexes: sleeping on a word of user memory.
+//
+// A waiter is keyed by the physical address of the word,
+// so processes that share the page (see shm.c) find each
+// other whatever address each has it mapped at.
+// Waiters are on a list, each sleeping on its own entry,
+// so that futex_wake() can wake just n of them.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+struct waiter {
+  uint64 key;      // physical address of the word
+  uint deadline;   // ticks to give up at, if timed
+  int timed;
+  int woken;
+  struct waiter *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct waiter *head;
+} futexes;
+
+void
+futexinit(void)
+{
+  initlock(&futexes.lock, "futex");
+}
+
+// The key for the user word at addr, or 0.
+static uint64
+futexkey(uint64 addr)
+{
+  uint64 pa;
+
+  if(addr % sizeof(int) != 0)
+    return 0;
+  if((pa = walkaddr(myproc()->pagetable, PGROUNDDOWN(addr))) == 0)
+    return 0;
+  return pa + addr % PGSIZE;
+}
+
+static void
+unlist(struct waiter *w)
+{
+  struct waiter **pp;
+
+  for(pp = &futexes.head; *pp != w; pp = &(*pp)->next)
+    ;
+  *pp = w->next;
+}
+
+// If the int at user address addr holds val, sleep until
+// futexwake() on it, or for timeout ticks unless timeout
+// is -1. Returns 0 if woken, -1 otherwise.
+int
+futexwait(uint64 addr, int val, int timeout)
+{
+  struct proc *p = myproc();
+  struct waiter w;
+  int v;
+
+  acquire(&tickslock);
+  w.deadline = ticks + timeout;
+  release(&tickslock);
+  w.timed = (timeout >= 0);
+  w.woken = 0;
+
+  // check the word under futexes.lock, so that a waker
+  // that changes it and then calls futexwake() can't
+  // slip in before this process is on the list.
+  acquire(&futexes.lock);
+  if(copyin(p->pagetable, (char*)&v, addr, sizeof(v)) < 0 ||
+     (w.key = futexkey(addr)) == 0 || v != val){
+    release(&futexes.lock);
+    return -1;
+  }
+  w.next = futexes.head;
+  futexes.head = &w;
+  while(!w.woken && !killed(p) && (!w.timed || (int)(w.deadline - ticks) > 0))
+    sleep(&w, &futexes.lock);
+  unlist(&w);
+  release(&futexes.lock);
+  return w.woken ? 0 : -1;
+}
+
+// Wake up to n waiters on the int at user address addr.
+// Returns the number woken.
+int
+futexwake(uint64 addr, int n)
+{
+  struct waiter *w;
+  uint64 key;
+  int i = 0;
+
+  acquire(&futexes.lock);
+  if((key = futexkey(addr)) != 0){
+    for(w = futexes.head; w && i < n; w = w->next){
+      if(w->key == key && !w->woken){
+        w->woken = 1;
+        wakeup(w);
+        i++;
+      }
+    }
+  }
+  release(&futexes.lock);
+  return i;
+}
+
+// Called by clockintr() with tickslock held,
+// to let timed waiters check their deadlines.
+void
+futextick(void)
+{
+  struct waiter *w;
+
+  if(futexes.head == 0)
+    return;
+  acquire(&futexes.lock);
+  for(w = futexes.head; w; w = w->next)
+    if(w->timed && (int)(w->deadline - ticks) <= 0)
+      wakeup(w);
+  release(&futexes.lock);
+}
@@ -10,74 +10,156 @@
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
-// any reasoning required about whether a commit might
-// write an uncommitted system call's updates to disk.
+// calls. A transaction is closed only when there are no FS
+// system calls active in it. Thus there is never any reasoning
+// required about whether a commit might write an uncommitted
+// system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the running transaction has been closed.
+//
+// Commits are done by a kernel thread, log_flusher(). When
+// no FS system calls are active it closes the running
+// transaction by copying the transaction's blocks into its
+// own shadow buffers, and then writes those to the log.
+// Meanwhile new FS system calls start a new running
+// transaction. So every transaction that piles up while the
+// previous one is being written commits as one group.
+// end_op() does not wait for the commit; log_force() does,
+// for fsync().
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
-//   block A
-//   block B
-//   block C
+//   header block, containing for each logged block A, B, C, ...
+//     its home block #, the log slot holding it, and a checksum
+//   slot 0
+//   slot 1
 //   ...
-// Log appends are synchronous.
+//
+// Committed blocks stay in the log; they are not copied to
+// their home locations after each commit. Instead the header
+// accumulates the latest committed copy of every block logged
+// since the last checkpoint, and the cached copies stay pinned
+// so that reads see them. A commit writes its blocks to free
+// slots, never over a slot the header on disk refers to, and
+// then writes a new header that refers to them. So a commit
+// takes two rounds of disk writes, and a block that is updated
+// over and over (a bitmap block, an inode block) goes to its
+// home location only once per checkpoint.
+//
+// When the log is more than half full, or a transaction does
+// not fit in the free slots, the flusher checkpoints: it
+// writes every logged block to its home location and then
+// clears the header.
+//
+// The driver does not offer the device a volatile write
+// cache, so a completed write is on disk and no separate
+// flush is needed.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
+// It must fit in the first 512-byte sector of the header block,
+// since the disk only writes a sector at a time atomically.
 struct logheader {
   int n;
   int block[LOGBLOCKS];
+  int slot[LOGBLOCKS];  // where block[i] is in the log
+  uint sum[LOGBLOCKS];  // checksum of that log slot
 };
 
 struct log {
   struct spinlock lock;
   int start;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int committing;  // log_flusher() is closing lh, please wait.
   int dev;
-  struct logheader lh;
+  uint seq;        // sequence number of the running transaction.
+  uint done;       // transactions up to this one are on disk.
+  struct logheader lh; // the running transaction.
 };
 struct log log;
 
+// State private to log_flusher(): the committed blocks in
+// the log (as in the on-disk header), the pinned cache buf
+// of each of them, a copy of what each log slot holds, and
+// the header and slot writes of the transaction being
+// committed.
+static struct {
+  struct logheader lh;
+  struct buf *home[LOGBLOCKS];
+  struct buf shadow[LOGBLOCKS];
+  struct logheader next;
+  struct buf *w[LOGBLOCKS];
+  int nw;
+} flush;
+
 static void recover_from_log(void);
-static void commit();
+static void log_flusher(void);
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) > 512)
     panic("initlog: too big logheader");
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
   log.dev = dev;
+  log.seq = 1;
+  log.done = 0;
   recover_from_log();
+
+  for (int i = 0; i < LOGBLOCKS; i++) {
+    initsleeplock(&flush.shadow[i].lock, "shadow");
+    flush.shadow[i].dev = dev;
+  }
+  if(kthread(log_flusher, "logflush") < 0)
+    panic("initlog: kthread");
+}
+
+// FNV-1a hash of a block's contents.
+static uint
+checksum(uchar *data)
+{
+  uint h = 2166136261;
+
+  for (int i = 0; i < BSIZE; i++) {
+    h ^= data[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// Does the on-disk log hold the blocks that
+// the header describes?
+static int
+log_intact(void)
+{
+  int i, ok = 1;
+
+  for (i = 0; i < log.lh.n && ok; i++) {
+    struct buf *lbuf = bread(log.dev, log.start+log.lh.slot[i]+1); // read log block
+    ok = checksum(lbuf->data) == log.lh.sum[i];
+    brelse(lbuf);
+  }
+  return ok;
 }
 
 // Copy committed blocks from log to their home location
+// after a crash.
 static void
-install_trans(int recovering)
+install_trans(void)
 {
-  int tail;
+  int i;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    if(recovering) {
-      printf("recovering tail %d dst %d\n", tail, log.lh.block[tail]);
-    }
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
+  for (i = 0; i < log.lh.n; i++) {
+    struct buf *lbuf = bread(log.dev, log.start+log.lh.slot[i]+1); // read log block
+    struct buf *dbuf = bread(log.dev, log.lh.block[i]); // read dst
     memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
     bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
     brelse(lbuf);
     brelse(dbuf);
   }
@@ -93,22 +175,26 @@ read_head(void)
   log.lh.n = lh->n;
   for (i = 0; i < log.lh.n; i++) {
     log.lh.block[i] = lh->block[i];
+    log.lh.slot[i] = lh->slot[i];
+    log.lh.sum[i] = lh->sum[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write a log header to disk.
+// This is the true point at which a
+// transaction commits.
 static void
-write_head(void)
+write_head(struct logheader *lh)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = lh->n;
+  for (i = 0; i < lh->n; i++) {
+    hb->block[i] = lh->block[i];
+    hb->slot[i] = lh->slot[i];
+    hb->sum[i] = lh->sum[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -118,9 +204,16 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(1); // if committed, copy from log to disk
+  if (log.lh.n > 0) {
+    if (log_intact()) {
+      printf("log: recovering %d blocks\n", log.lh.n);
+      install_trans(); // copy from log to disk
+    } else {
+      printf("log: bad checksum, not recovering\n");
+    }
+  }
   log.lh.n = 0;
-  write_head(); // clear the log
+  write_head(&log.lh); // clear the log
 }
 
 // called at the start of each FS system call.
@@ -143,19 +236,17 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// if this was the last outstanding operation,
+// the flusher can close the transaction.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
   if(log.committing)
     panic("log.committing");
   if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+    wakeup(&log.outstanding);
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -163,49 +254,168 @@ end_op(void)
     wakeup(&log);
   }
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// Wait until the updates of every FS system call
+// that has already called end_op() are on disk.
+void
+log_force(void)
+{
+  uint seq;
+
+  acquire(&log.lock);
+  seq = log.lh.n > 0 ? log.seq : log.seq - 1;
+  while(log.done < seq)
+    sleep(&log.done, &log.lock);
+  release(&log.lock);
+}
+
+// Sort bufs by block number, so that bwritev()
+// can merge neighbours into one request.
+static void
+sortbufs(struct buf **bs, int n)
+{
+  struct buf *t;
+
+  for (int i = 1; i < n; i++) {
+    for (int j = i; j > 0 && bs[j-1]->blockno > bs[j]->blockno; j--) {
+      t = bs[j-1];
+      bs[j-1] = bs[j];
+      bs[j] = t;
+    }
   }
 }
 
-// Copy modified blocks from cache to log.
+// Write every logged block to its home location, all
+// concurrently, and then empty the log.
 static void
-write_log(void)
+checkpoint(void)
 {
-  int tail;
+  struct buf *bs[LOGBLOCKS];
+  int i;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  for (i = 0; i < flush.lh.n; i++) {
+    bs[i] = &flush.shadow[flush.lh.slot[i]];
+    bs[i]->blockno = flush.lh.block[i];
   }
+  sortbufs(bs, flush.lh.n);
+  bwritev(bs, flush.lh.n);
+
+  // the cached copies may now be evicted, unless
+  // the running transaction has pinned them again.
+  for (i = 0; i < flush.lh.n; i++)
+    bunpin(flush.home[i]);
+
+  flush.lh.n = 0;
+  write_head(&flush.lh);
 }
 
+// Close the running transaction: copy its blocks into
+// free log slots' shadows, and prepare a header that
+// covers them. No FS system calls are active, so nothing
+// modifies the blocks meanwhile.
 static void
-commit()
+freeze(void)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
+  struct logheader *nlh = &flush.next;
+  struct buf *b;
+  char used[LOGBLOCKS];
+  int i, j, s;
+
+  memset(used, 0, sizeof(used));
+  for (i = 0; i < flush.lh.n; i++)
+    used[flush.lh.slot[i]] = 1;
+
+  *nlh = flush.lh;
+  flush.nw = 0;
+  s = 0;
+  for (i = 0; i < log.lh.n; i++) {
+    while (used[s])
+      s++;
+    used[s] = 1;
+
+    b = bread(log.dev, log.lh.block[i]); // pinned, so cached
+    memmove(flush.shadow[s].data, b->data, BSIZE);
+    flush.shadow[s].blockno = log.start+s+1;
+    flush.w[flush.nw++] = &flush.shadow[s];
+
+    for (j = 0; j < nlh->n; j++) {
+      if (nlh->block[j] == log.lh.block[i])   // already in the log
+        break;
+    }
+    if (j == nlh->n) {
+      nlh->block[j] = log.lh.block[i];
+      flush.home[j] = b;
+      nlh->n++;
+    } else {
+      bunpin(b);   // the log already holds a pin
+    }
+    nlh->slot[j] = s;
+    nlh->sum[j] = checksum(flush.shadow[s].data);
+    brelse(b);
+  }
+}
+
+// Write the frozen transaction to disk. The slots are
+// in order, so neighbours go out as one request.
+static void
+commit(void)
+{
+  bwritev(flush.w, flush.nw);  // Write the blocks to the log
+  write_head(&flush.next);     // Write header to disk -- the real commit
+  flush.lh = flush.next;
+}
+
+// The log flusher kernel thread. Commits the running
+// transaction whenever it has updates and no FS system
+// call is active in it.
+static void
+log_flusher(void)
+{
+  uint seq;
+
+  // the shadow bufs belong to this thread,
+  // as bwritev() insists.
+  for (int i = 0; i < LOGBLOCKS; i++)
+    acquiresleep(&flush.shadow[i].lock);
+
+  for(;;){
+    // checkpoint early when the log is filling up,
+    // while FS system calls can still run.
+    if(flush.lh.n > LOGBLOCKS/2)
+      checkpoint();
+
+    acquire(&log.lock);
+    while(log.lh.n == 0 || log.outstanding > 0)
+      sleep(&log.outstanding, &log.lock);
+    log.committing = 1;
+    release(&log.lock);
+
+    // call these w/o holding locks, since
+    // bread() and bwritev() may sleep.
+    if(flush.lh.n + log.lh.n > LOGBLOCKS)
+      checkpoint();
+    freeze();
+
+    acquire(&log.lock);
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    seq = log.seq++;
+    log.committing = 0;
+    wakeup(&log);
+    release(&log.lock);
+
+    commit();
+
+    acquire(&log.lock);
+    log.done = seq;
+    wakeup(&log.done);
+    release(&log.lock);
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// log_flusher() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -234,4 +444,3 @@ log_write(struct buf *b)
   }
   release(&log.lock);
 }
-
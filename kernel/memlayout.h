@@ -54,6 +54,28 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   SHMBASE (shared memory segments, see shm.c)
+//   VDSO (the time page, see vdso.h)
+//   user data pages, one per thread
+//   trapframes of threads made by clone()
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// a thread's trapframe goes beneath, in a page chosen
+// by its index i in proc[].
+#define NTHREADFRAME 64       // at least NPROC
+#define THREADFRAME(i) (TRAPFRAME - ((i)+1)*PGSIZE)
+
+// the read-only data page of the thread whose
+// trapframe is at va.
+#define USERDATA(va) ((va) - (NTHREADFRAME+1)*PGSIZE)
+
+// the time page, beneath the lowest data page.
+#define VDSO (USERDATA(THREADFRAME(NTHREADFRAME-1)) - PGSIZE)
+
+// shared memory is mapped in fixed-size slots
+// beneath the time page.
+#define SHMSLOT (512*PGSIZE)  // largest segment
+#define NSHMSLOT 8            // segments a process can map
+#define SHMBASE (VDSO - NSHMSLOT*SHMSLOT)
@@ -2,14 +2,23 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // number of i-nodes to cache before recycling
+#define NDENTRY     128  // size of directory entry cache
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
+#define MAXOPBLOCKS  12  // max # of blocks any FS op writes
 #define LOGBLOCKS    (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define NBUF         (LOGBLOCKS*3)  // size of disk block cache
+#define FSSIZE       4000  // size of file system in blocks
+#define NPREALLOC    8     // blocks reserved ahead for a file being written
 #define MAXPATH      128   // maximum file path name
+#define MAXIOV       16    // maximum buffers in readv/writev
+#define MAXPIPE      16    // maximum pages in a pipe, a power of two
+#define MAXPIPEPAGES 64    // maximum pages in all pipes beyond their first
+#define NPOLLFD      32    // maximum files in one poll()
+#define NSHM         16    // maximum shared memory segments
 #define USERSTACK    1     // user stack pages
+#define DISKSPIN     500   // r_time() units to poll the disk before sleeping
+#define MAXDISKSPIN  10000 // most diskstat() may set DISKSPIN to (1 ms)
 
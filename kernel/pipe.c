@@ -7,18 +7,38 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
+#include "fcntl.h"
 
-#define PIPESIZE 512
+#define PIPESIZE PGSIZE  // default capacity
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data[MAXPIPE];  // ring buffer, a page at a time
+  uint size;      // capacity, a power-of-two number of pages
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  struct waitq pollq;  // pollers of either end
 };
 
+// pages held by all pipes beyond the first
+// page each, which F_SETPIPE_SZ adds.
+static int pipepages;
+
+// Take n more pages from the MAXPIPEPAGES budget, or
+// give back -n. Returns -1 if there aren't enough.
+static int
+pipecharge(int n)
+{
+  if(__sync_add_and_fetch(&pipepages, n) > MAXPIPEPAGES && n > 0){
+    __sync_fetch_and_sub(&pipepages, n);
+    return -1;
+  }
+  return 0;
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -30,24 +50,33 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  if((pi->data[0] = kalloc()) == 0)
+    goto bad;
+  pi->size = PIPESIZE;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->pollq.head = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
+  (*f0)->nonblock = 0;
   (*f0)->pipe = pi;
   (*f1)->type = FD_PIPE;
   (*f1)->readable = 0;
   (*f1)->writable = 1;
+  (*f1)->nonblock = 0;
   (*f1)->pipe = pi;
   return 0;
 
  bad:
-  if(pi)
+  if(pi){
+    if(pi->data[0])
+      kfree(pi->data[0]);
     kfree((char*)pi);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -55,9 +84,28 @@ pipealloc(struct file **f0, struct file **f1)
   return -1;
 }
 
+// Address in the ring of the byte at stream position pos.
+// The bytes up to the end of its page are contiguous.
+static char*
+ringaddr(struct pipe *pi, uint pos)
+{
+  return pi->data[(pos % pi->size) / PGSIZE] + pos % PGSIZE;
+}
+
+// Number of bytes from pos to the end of its page, at most n.
+static int
+runlen(uint pos, int n)
+{
+  if(n > PGSIZE - pos % PGSIZE)
+    n = PGSIZE - pos % PGSIZE;
+  return n;
+}
+
 void
 pipeclose(struct pipe *pi, int writable)
 {
+  int i;
+
   acquire(&pi->lock);
   if(writable){
     pi->writeopen = 0;
@@ -66,48 +114,82 @@ pipeclose(struct pipe *pi, int writable)
     pi->readopen = 0;
     wakeup(&pi->nwrite);
   }
+  pollwake(&pi->pollq);
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
+    pipecharge(1 - pi->size / PGSIZE);
+    for(i = 0; i < pi->size / PGSIZE; i++)
+      kfree(pi->data[i]);
     kfree((char*)pi);
   } else
     release(&pi->lock);
 }
 
+// Write n bytes from addr to the pipe.
+// addr is a user virtual address if user_src is 1,
+// a kernel address otherwise.
+// If nonblock, write only what fits, and return -EAGAIN
+// if nothing does.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, int user_src, uint64 addr, int n, int nonblock)
 {
-  int i = 0;
+  int i = 0, m, wake = 0;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
   while(i < n){
     if(pi->readopen == 0 || killed(pr)){
+      if(wake){
+        wakeup(&pi->nread);
+        pollwake(&pi->pollq);
+      }
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+    if(pi->nwrite == pi->nread + pi->size){ //DOC: pipewrite-full
+      if(nonblock){
+        if(i == 0)
+          i = -EAGAIN;
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      }
+      if(wake){
+        wakeup(&pi->nread);
+        pollwake(&pi->pollq);
+        wake = 0;
+      }
+      sleep(&pi->nwrite, &pi->lock);
+      continue;
     }
+    // copy as much as fits in the current page.
+    m = n - i;
+    if(m > pi->size - (pi->nwrite - pi->nread))
+      m = pi->size - (pi->nwrite - pi->nread);
+    m = runlen(pi->nwrite, m);
+    if(either_copyin(ringaddr(pi, pi->nwrite), user_src, addr + i, m) == -1)
+      break;
+    // readers sleep only on an empty pipe.
+    if(pi->nwrite == pi->nread)
+      wake = 1;
+    pi->nwrite += m;
+    i += m;
+  }
+  if(wake){
+    wakeup(&pi->nread);
+    pollwake(&pi->pollq);
   }
-  wakeup(&pi->nread);
   release(&pi->lock);
 
   return i;
 }
 
+// Read up to n bytes from the pipe to addr, which is
+// a user virtual address if user_dst is 1.
+// If nonblock, return -EAGAIN instead of waiting.
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+piperead(struct pipe *pi, int user_dst, uint64 addr, int n, int nonblock)
 {
-  int i;
+  int i, m, full;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
@@ -115,20 +197,127 @@ piperead(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
+    if(nonblock){
+      release(&pi->lock);
+      return -EAGAIN;
+    }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1) {
+  full = (pi->nwrite == pi->nread + pi->size);
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    m = n - i;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    m = runlen(pi->nread, m);
+    if(either_copyout(user_dst, addr + i, ringaddr(pi, pi->nread), m) == -1) {
       if(i == 0)
         i = -1;
       break;
     }
-    pi->nread++;
+    pi->nread += m;
+  }
+  // writers sleep only on a full pipe.
+  if(full && i > 0){
+    wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+    pollwake(&pi->pollq);
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
+
+int
+pipesize(struct pipe *pi)
+{
+  int n;
+
+  acquire(&pi->lock);
+  n = pi->size;
+  release(&pi->lock);
+  return n;
+}
+
+// Change the pipe's capacity to at least n bytes,
+// rounded up to a power-of-two number of pages.
+// Fails if the pipe holds more than would fit.
+// Returns the new capacity.
+int
+pipesetsize(struct pipe *pi, int n)
+{
+  char *data[MAXPIPE];
+  uint np, i, pos, m, size;
+
+  if(n <= 0 || n > MAXPIPE*PGSIZE)
+    return -1;
+  for(np = 1; np*PGSIZE < n; np *= 2)
+    ;
+  // charge for the new pages until the old ones are freed.
+  if(pipecharge(np - 1) < 0)
+    return -1;
+  for(i = 0; i < np; i++){
+    if((data[i] = kalloc()) == 0){
+      while(i > 0)
+        kfree(data[--i]);
+      pipecharge(1 - np);
+      return -1;
+    }
+  }
+
+  acquire(&pi->lock);
+  size = np*PGSIZE;
+  if(pi->nwrite - pi->nread > size){
+    release(&pi->lock);
+    for(i = 0; i < np; i++)
+      kfree(data[i]);
+    pipecharge(1 - np);
+    return -1;
+  }
+  // the pages line up in both rings, so copy a page's run at a time.
+  for(pos = pi->nread; pos != pi->nwrite; pos += m){
+    m = runlen(pos, pi->nwrite - pos);
+    memmove(data[(pos % size) / PGSIZE] + pos % PGSIZE, ringaddr(pi, pos), m);
+  }
+  // swap, leaving the old pages in data to free.
+  for(i = 0; i < MAXPIPE; i++){
+    char *t = pi->data[i];
+    pi->data[i] = i < np ? data[i] : 0;
+    data[i] = i < pi->size / PGSIZE ? t : 0;
+  }
+  np = pi->size / PGSIZE;
+  if(size > pi->size){
+    wakeup(&pi->nwrite);
+    pollwake(&pi->pollq);
+  }
+  pi->size = size;
+  release(&pi->lock);
+
+  for(i = 0; i < np; i++)
+    kfree(data[i]);
+  pipecharge(1 - np);
+  return size;
+}
+
+// Which of POLLIN/POLLOUT the pipe end is ready for,
+// plus POLLHUP or POLLERR if the other end is closed.
+// If e is not 0, put it on the pipe's wait queue.
+int
+pipepoll(struct pipe *pi, int writable, struct pollent *e)
+{
+  int r = 0;
+
+  if(e)
+    pollwait(&pi->pollq, e);
+  acquire(&pi->lock);
+  if(writable){
+    if(pi->readopen == 0)
+      r = POLLERR;
+    else if(pi->nwrite != pi->nread + pi->size)
+      r = POLLOUT;
+  } else {
+    if(pi->nread != pi->nwrite)
+      r = POLLIN;
+    if(pi->writeopen == 0)
+      r |= POLLHUP;
+  }
+  release(&pi->lock);
+  return r;
+}
@@ -0,0 +1,155 @@
+//
+// Waiting for any of several files at once.
+//
+// Each object that can make a poller wait (a pipe, the
+// console) has a wait queue. poll() puts an entry on the
+// queue of each file it watches, checks them all, and
+// sleeps until pollwake() is called on one of the queues.
+// The entries live on the poller's kernel stack.
+//
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "fs.h"
+#include "file.h"
+#include "poll.h"
+#include "proc.h"
+#include "defs.h"
+
+// protects all wait queues and the ready flags of
+// their entries.
+struct spinlock polllock;
+
+// pollers with a timeout, woken every tick.
+struct waitq tickq;
+
+void
+pollinit(void)
+{
+  initlock(&polllock, "poll");
+}
+
+// Put e on q. Call this before checking whether the
+// file is ready, so that no wakeup is missed.
+void
+pollwait(struct waitq *q, struct pollent *e)
+{
+  acquire(&polllock);
+  e->q = q;
+  e->next = q->head;
+  q->head = e;
+  release(&polllock);
+}
+
+static void
+pollremove(struct pollent *e)
+{
+  struct pollent **pp;
+
+  for(pp = &e->q->head; *pp; pp = &(*pp)->next){
+    if(*pp == e){
+      *pp = e->next;
+      break;
+    }
+  }
+  e->q = 0;
+}
+
+// Wake the pollers on q.
+// The caller must hold the lock under which the pollers
+// check the object's state, which makes it safe to skip
+// an empty queue without taking polllock.
+void
+pollwake(struct waitq *q)
+{
+  struct pollent *e;
+
+  if(q->head == 0)
+    return;
+  acquire(&polllock);
+  for(e = q->head; e; e = e->next){
+    *e->ready = 1;
+    wakeup(e->ready);
+  }
+  release(&polllock);
+}
+
+// Called by clockintr() with tickslock held.
+void
+polltick(void)
+{
+  pollwake(&tickq);
+}
+
+// Wait until one of the n files in f is ready for the
+// events in fds, or for timeout ticks if timeout is not -1.
+// Fills in fds[i].revents.
+// Returns the number of ready files, 0 on timeout.
+int
+pollfiles(struct file **f, struct pollfd *fds, int n, int timeout)
+{
+  struct pollent pe[NPOLLFD], te;
+  struct proc *p = myproc();
+  int i, nready, ready;
+  uint t0, now;
+
+  for(i = 0; i < n; i++){
+    pe[i].ready = &ready;
+    pe[i].q = 0;
+  }
+  te.ready = &ready;
+  te.q = 0;
+  acquire(&tickslock);
+  t0 = ticks;
+  if(timeout > 0)
+    pollwait(&tickq, &te);
+  release(&tickslock);
+
+  for(;;){
+    acquire(&polllock);
+    ready = 0;
+    release(&polllock);
+
+    nready = 0;
+    for(i = 0; i < n; i++){
+      fds[i].revents = 0;
+      if(fds[i].fd < 0)
+        continue;
+      if(f[i] == 0)
+        fds[i].revents = POLLNVAL;
+      else
+        fds[i].revents = filepoll(f[i], fds[i].events,
+                                  (timeout != 0 && pe[i].q == 0) ? &pe[i] : 0);
+      if(fds[i].revents)
+        nready++;
+    }
+    if(nready > 0 || timeout == 0)
+      break;
+    if(killed(p)){
+      nready = -1;
+      break;
+    }
+    acquire(&tickslock);
+    now = ticks;
+    release(&tickslock);
+    if(timeout > 0 && now - t0 >= timeout)
+      break;
+
+    acquire(&polllock);
+    if(!ready)
+      sleep(&ready, &polllock);
+    release(&polllock);
+  }
+
+  acquire(&polllock);
+  for(i = 0; i < n; i++)
+    if(pe[i].q)
+      pollremove(&pe[i]);
+  if(te.q)
+    pollremove(&te);
+  release(&polllock);
+  return nready;
+}
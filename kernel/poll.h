@@ -0,0 +1,12 @@
+// poll() events
+#define POLLIN    0x001  // there is data to read
+#define POLLOUT   0x004  // writing will not block
+#define POLLERR   0x008  // the reader has gone (returned only)
+#define POLLHUP   0x010  // the writer has gone (returned only)
+#define POLLNVAL  0x020  // fd is not open (returned only)
+
+struct pollfd {
+  int fd;         // file descriptor, ignored if negative
+  short events;   // events to wait for
+  short revents;  // events that happened
+};
@@ -5,6 +5,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "vdso.h"
 
 #define MLFQ_DEBUG 1//be used for print info. DONE.
 
@@ -12,6 +13,8 @@ struct cpu cpus[NCPU];
 
 struct proc proc[NPROC];
 
+struct group groups[NPROC];
+
 struct proc_queue queues[NQUEUE]; // Q0, Q1, Q2
 struct spinlock queue_locks[NQUEUE]; // locks for each queue.
 int promote_needed = 0;
@@ -82,7 +85,9 @@ int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
+static void kthreadret(void);
 static void freeproc(struct proc *p);
+static void putgroup(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
@@ -114,6 +119,7 @@ void
 procinit(void)
 {
   struct proc *p;
+  struct group *g;
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
@@ -122,6 +128,10 @@ procinit(void)
       p->state = UNUSED;
       p->kstack = KSTACK((int) (p - proc));
   }
+  for(g = groups; g < &groups[NPROC]; g++){
+    initlock(&g->lock, "group");
+    g->asid = useasids ? (g - groups) + 1 : 0;
+  }
 
   for(int i = 0; i < 3; i++) {
     queues[i].head = 0;
@@ -249,14 +259,41 @@ allocpid()
   return pid;
 }
 
+// Find an unused group and return it with one reference,
+// or 0 if there is none.
+static struct group*
+allocgroup(void)
+{
+  struct group *g;
+
+  for(g = groups; g < &groups[NPROC]; g++){
+    acquire(&g->lock);
+    if(g->ref == 0){
+      g->ref = 1;
+      g->sz = 0;
+      g->cwd = 0;
+      g->spare = 0;
+      // harts may hold TLB entries from the last user of g.
+      groupflush(g);
+      release(&g->lock);
+      return g;
+    }
+    release(&g->lock);
+  }
+  return 0;
+}
+
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
 // and return with p->lock held.
+// If share is not 0, the new proc is a thread in share's
+// group, else it gets a group and page table of its own.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc*
-allocproc(void)
+allocproc(struct proc *share)
 {
   struct proc *p;
+  int r;
 
   for(p = proc; p < &proc[NPROC]; p++) {
     acquire(&p->lock);
@@ -290,13 +327,51 @@ found:
     return 0;
   }
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
+  // And the page user code reads its pid from. A thread
+  // takes one an exited thread of its group left behind.
+  if(share){
+    acquire(&share->group->lock);
+    if((p->userdata = share->group->spare) != 0)
+      share->group->spare = *(void**)p->userdata;
+    release(&share->group->lock);
+  }
+  if(p->userdata == 0 &&
+     (p->userdata = (struct userdata *)kalloc()) == 0){
     freeproc(p);
     release(&p->lock);
     return 0;
   }
+  memset(p->userdata, 0, PGSIZE);
+  p->userdata->pid = p->pid;
+
+  if(share == 0){
+    // An empty user page table.
+    p->thread = 0;
+    p->trapva = TRAPFRAME;
+    if((p->group = allocgroup()) == 0 ||
+       (p->pagetable = proc_pagetable(p)) == 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+  } else {
+    // Share the page table, with this thread's trapframe
+    // in a page of its own.
+    p->thread = 1;
+    p->trapva = THREADFRAME(p - proc);
+    p->group = share->group;
+    p->pagetable = share->pagetable;
+    acquire(&p->group->lock);
+    p->group->ref++;
+    r = proc_mapframes(p->pagetable, p, p->trapva);
+    groupflush(p->group);
+    release(&p->group->lock);
+    if(r < 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+  }
 
   // Set up new context to start executing at forkret,
   // which returns to user space.
@@ -313,24 +388,55 @@ found:
 static void
 freeproc(struct proc *p)
 {
+  if(p->group)
+    putgroup(p);
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
-  p->pagetable = 0;
-  p->sz = 0;
+  if(p->userdata)
+    kfree((void*)p->userdata);
+  p->userdata = 0;
+  p->thread = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->kfn = 0;
   p->state = UNUSED;
 }
 
+// Drop p's reference to its group, and unmap p's trapframe.
+// The last thread frees the group's page table and memory;
+// kexit() has already closed its files.
+static void
+putgroup(struct proc *p)
+{
+  struct group *g = p->group;
+  void *pa;
+
+  acquire(&g->lock);
+  if(p->pagetable){
+    proc_unmapframes(p->pagetable, p->trapva);
+    groupflush(g);
+    if(g->ref == 1)
+      proc_freepagetable(p->pagetable, g->sz);
+  }
+  if(g->ref == 1){
+    while((pa = g->spare) != 0){
+      g->spare = *(void**)pa;
+      kfree(pa);
+    }
+  }
+  g->ref--;
+  release(&g->lock);
+  p->group = 0;
+  p->pagetable = 0;
+}
+
 // Create a user page table for a given process, with no user memory,
-// but with trampoline and trapframe pages.
+// but with trampoline, time, trapframe and user data pages.
 pagetable_t
 proc_pagetable(struct proc *p)
 {
@@ -351,11 +457,18 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
+  // map the time page, which user code may read.
+  if(mappages(pagetable, VDSO, PGSIZE, (uint64)vdso, PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
   // map the trapframe page just below the trampoline page, for
   // trampoline.S.
-  if(mappages(pagetable, TRAPFRAME, PGSIZE,
-              (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
+  if(proc_mapframes(pagetable, p, TRAPFRAME) < 0){
     uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, VDSO, 1, 0);
     uvmfree(pagetable, 0);
     return 0;
   }
@@ -363,13 +476,69 @@ proc_pagetable(struct proc *p)
   return pagetable;
 }
 
+// Map p's trapframe at va, for trampoline.S, and its
+// user data page at USERDATA(va), for user code.
+int
+proc_mapframes(pagetable_t pagetable, struct proc *p, uint64 va)
+{
+  if(mappages(pagetable, va, PGSIZE,
+              (uint64)(p->trapframe), PTE_R | PTE_W) < 0)
+    return -1;
+  if(mappages(pagetable, USERDATA(va), PGSIZE,
+              (uint64)(p->userdata), PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, va, 1, 0);
+    return -1;
+  }
+  return 0;
+}
+
+// Undo proc_mapframes().
+void
+proc_unmapframes(pagetable_t pagetable, uint64 va)
+{
+  uvmunmap(pagetable, va, 1, 0);
+  uvmunmap(pagetable, USERDATA(va), 1, 0);
+}
+
+// Note a change to g's page table. Each hart flushes
+// g's TLB entries before it next returns to user space
+// in g; one already there may use stale entries until
+// its next trap.
+void
+groupflush(struct group *g)
+{
+  __sync_fetch_and_add(&g->tlbgen, 1);
+}
+
+// Return the satp for p's page table, after flushing
+// this hart's TLB entries for it if they may be stale.
+// Interrupts must be off.
+uint64
+usersatp(struct proc *p)
+{
+  struct group *g = p->group;
+  struct cpu *c = mycpu();
+  uint gen;
+
+  if(g->asid){
+    gen = __atomic_load_n(&g->tlbgen, __ATOMIC_ACQUIRE);
+    if(c->tlbgen[g->asid] != gen){
+      c->tlbgen[g->asid] = gen;
+      sfence_vma_asid(g->asid);
+    }
+  }
+  return MAKE_SATP(p->pagetable, g->asid);
+}
+
 // Free a process's page table, and free the
 // physical memory it refers to.
 void
 proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
+  shmdetachall(pagetable);
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
-  uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, VDSO, 1, 0);
+  proc_unmapframes(pagetable, TRAPFRAME);
   uvmfree(pagetable, sz);
 }
 
@@ -379,10 +548,10 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
   
-  p->cwd = namei("/");
+  p->group->cwd = namei("/");
 
   p->state = RUNNABLE;
 
@@ -390,25 +559,40 @@ userinit(void)
 }
 
 // Grow or shrink user memory by n bytes.
+// Only a group's last thread may shrink it: the other
+// threads' harts may use stale TLB entries for freed
+// memory until their next trap.
+// Store the old size in *oldsz, read under the same lock
+// as the change, so that threads growing memory at once
+// get regions of their own.
 // Return 0 on success, -1 on failure.
 int
-growproc(int n)
+growproc(int n, uint64 *oldsz)
 {
   uint64 sz;
-  struct proc *p = myproc();
+  struct group *g = myproc()->group;
 
-  sz = p->sz;
+  acquire(&g->lock);
+  sz = *oldsz = g->sz;
   if(n > 0){
-    if(sz + n > TRAPFRAME) {
+    if(sz + n > SHMBASE) {
+      release(&g->lock);
       return -1;
     }
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    if((sz = uvmalloc(myproc()->pagetable, sz, sz + n, PTE_W)) == 0) {
+      release(&g->lock);
       return -1;
     }
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    if(g->ref > 1){
+      release(&g->lock);
+      return -1;
+    }
+    sz = uvmdealloc(myproc()->pagetable, sz, sz + n);
   }
-  p->sz = sz;
+  g->sz = sz;
+  groupflush(g);
+  release(&g->lock);
   return 0;
 }
 
@@ -417,22 +601,36 @@ growproc(int n)
 int
 kfork(void)
 {
-  int i, pid;
+  int i, pid, r;
   struct proc *np;
   struct proc *p = myproc();
+  struct group *g = p->group, *ng;
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(0)) == 0){
     return -1;
   }
+  ng = np->group;
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  acquire(&g->lock);
+  r = uvmcopy(p->pagetable, np->pagetable, g->sz);
+  if(r == 0)
+    r = shmfork(p->pagetable, np->pagetable);
+  ng->sz = g->sz;
+  if(r == 0){
+    // increment reference counts on open file descriptors.
+    for(i = 0; i < NOFILE; i++)
+      if(g->ofile[i])
+        ng->ofile[i] = filedup(g->ofile[i]);
+    ng->cwd = idup(g->cwd);
+  }
+  release(&g->lock);
+  if(r < 0){
     freeproc(np);
     release(&np->lock);
     return -1;
   }
-  np->sz = p->sz;
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -440,11 +638,8 @@ kfork(void)
   // Cause fork to return 0 in the child.
   np->trapframe->a0 = 0;
 
-  // increment reference counts on open file descriptors.
-  for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
-  np->cwd = idup(p->cwd);
+  // Give the child its own user data page.
+  np->trapframe->tp = USERDATA(np->trapva);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -463,6 +658,80 @@ kfork(void)
   return pid;
 }
 
+// Create a kernel thread: a process that runs fn() in the
+// kernel and never returns to user space. It has no parent,
+// no open files and no current directory.
+// Returns its pid, or -1 if no process slot is free.
+int
+kthread(void (*fn)(void), char *name)
+{
+  int pid;
+  struct proc *p;
+
+  if((p = allocproc(0)) == 0)
+    return -1;
+
+  p->kfn = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  pid = p->pid;
+  p->state = RUNNABLE;
+
+  release(&p->lock);
+
+  return pid;
+}
+
+// Create a thread: a process that shares the caller's
+// memory, open files and current directory. It starts
+// in user space at fn(arg), with its stack pointer at
+// stack, and must call exit() rather than return.
+// Returns its pid.
+int
+kclone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if((np = allocproc(p)) == 0)
+    return -1;
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->a0 = arg;
+  np->trapframe->sp = stack;
+  np->trapframe->ra = 0;
+  np->trapframe->tp = USERDATA(np->trapva);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  pid = np->pid;
+
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return pid;
+}
+
+// Kill the other threads in p's group.
+static void
+killgroup(struct proc *p)
+{
+  struct proc *pp;
+
+  for(pp = proc; pp < &proc[NPROC]; pp++)
+    if(pp != p && pp->group == p->group)
+      kkill(pp->pid);
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
@@ -481,27 +750,55 @@ reparent(struct proc *p)
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait().
+// A thread made by clone() exits alone; the process's
+// first thread takes the others with it.
 void
 kexit(int status)
 {
   struct proc *p = myproc();
+  struct group *g = p->group;
+  int last;
 
   if(p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
+  if(!p->thread)
+    killgroup(p);
+
+  // Leave the group, unless this is its last thread,
+  // which releases what the group holds.
+  acquire(&g->lock);
+  last = (g->ref == 1);
+  if(!last){
+    proc_unmapframes(p->pagetable, p->trapva);
+    groupflush(g);
+    // the other threads' harts may read the user data page
+    // through stale TLB entries until they trap, so keep it
+    // in the group rather than free it.
+    *(void**)p->userdata = g->spare;
+    g->spare = p->userdata;
+    p->userdata = 0;
+    g->ref--;
+    p->group = 0;
+    p->pagetable = 0;
   }
+  release(&g->lock);
+
+  if(last){
+    // Close all open files.
+    for(int fd = 0; fd < NOFILE; fd++){
+      if(g->ofile[fd]){
+        struct file *f = g->ofile[fd];
+        fileclose(f);
+        g->ofile[fd] = 0;
+      }
+    }
 
-  begin_op();
-  iput(p->cwd);
-  end_op();
-  p->cwd = 0;
+    begin_op();
+    iput(g->cwd);
+    end_op();
+    g->cwd = 0;
+  }
 
   acquire(&wait_lock);
 
@@ -523,13 +820,16 @@ kexit(int status)
   panic("zombie exit");
 }
 
-// Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
-int
-kwait(uint64 addr)
+// Wait for a child to exit and return its pid: a thread
+// made by clone() if thread is set, else a process.
+// Only the child pid, unless pid is 0. init reaps
+// orphaned threads along with processes.
+// Return -1 if there is no such child.
+static int
+waitchild(int pid, int thread, uint64 addr)
 {
   struct proc *pp;
-  int havekids, pid;
+  int havekids;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
@@ -538,7 +838,8 @@ kwait(uint64 addr)
     // Scan through table looking for exited children.
     havekids = 0;
     for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
+      if(pp->parent == p && (pid == 0 || pp->pid == pid) &&
+         (pp->thread == thread || p == initproc)){
         // make sure the child isn't still in exit() or swtch().
         acquire(&pp->lock);
 
@@ -572,6 +873,22 @@ kwait(uint64 addr)
   }
 }
 
+// Wait for a child process to exit and return its pid.
+// Return -1 if this process has no children.
+int
+kwait(uint64 addr)
+{
+  return waitchild(0, 0, addr);
+}
+
+// Wait for thread tid, or any thread if tid is 0,
+// made by this process to exit, and return its pid.
+int
+kjoin(int tid, uint64 addr)
+{
+  return waitchild(tid, 1, addr);
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -709,11 +1026,25 @@ forkret(void)
 
   // return to user space, mimicing usertrap()'s return.
   prepare_return();
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = usersatp(p);
   uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
   ((void (*)(uint64))trampoline_userret)(satp);
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kfn();
+  panic("kthread returned");
+}
+
 // Sleep on channel chan, releasing condition lock lk.
 // Re-acquires lk when awakened.
 void
@@ -788,8 +1119,11 @@ kkill(int pid)
     if(p->pid == pid){
       p->killed = 1;
       if(p->state == SLEEPING){
-        // Wake process from sleep().
+        // Wake process from sleep(), and put it back
+        // on a queue so the scheduler finds it; a
+        // group exit relies on this to stop threads.
         p->state = RUNNABLE;
+        enqueue_proc(p, p->queue_level);
       }
       release(&p->lock);
       return 0;
@@ -24,6 +24,7 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint tlbgen[NPROC+1];       // group tlbgen as of the last flush, by ASID
 };
 
 extern struct cpu cpus[NCPU];
@@ -88,6 +89,20 @@ enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 #define PROMOTION_INTERVAL 100
 #define NQUEUE 3//DONE. 
 
+// What the threads of a process share. fork() makes a
+// process with one thread; clone() adds threads to it.
+struct group {
+  struct spinlock lock;        // protects everything here and
+                               // changes to the page table
+  int ref;                     // threads using it, 0 if free
+  uint64 sz;                   // Size of process memory (bytes)
+  struct file *ofile[NOFILE];  // Open files
+  struct inode *cwd;           // Current directory
+  int asid;                    // in satp, or 0 if !useasids
+  uint tlbgen;                 // bumped by groupflush()
+  void *spare;                 // exited threads' user data pages
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -112,13 +127,15 @@ struct proc {
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // User page table
+  struct group *group;         // Memory, files and directory
+  pagetable_t pagetable;       // User page table, group's
   struct trapframe *trapframe; // data page for trampoline.S
+  uint64 trapva;               // user address of trapframe
+  struct userdata *userdata;   // page mapped at USERDATA(trapva)
+  int thread;                  // made by clone()?
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
-  struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  void (*kfn)(void);           // Body of a kernel thread, else 0
 };
 
 extern int promote_needed;
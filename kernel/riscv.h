@@ -164,6 +164,14 @@ w_stvec(uint64 x)
   asm volatile("csrw stvec, %0" : : "r" (x));
 }
 
+// Supervisor Scratch register, holds the user address
+// of the trapframe while in user space.
+static inline void 
+w_sscratch(uint64 x)
+{
+  asm volatile("csrw sscratch, %0" : : "r" (x));
+}
+
 static inline uint64
 r_stvec()
 {
@@ -222,7 +230,10 @@ w_pmpaddr0(uint64 x)
 // use riscv's sv39 page table scheme.
 #define SATP_SV39 (8L << 60)
 
-#define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
+// the address space identifier goes in bits 44-59.
+// the kernel's is 0; see useasids in vm.c.
+#define SATP_ASID(satp) (((satp) >> 44) & 0xffff)
+#define MAKE_SATP(pagetable, asid) (SATP_SV39 | ((uint64)(asid) << 44) | (((uint64)pagetable) >> 12))
 
 // supervisor address translation and protection;
 // holds the address of the page table.
@@ -344,6 +355,13 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries of one address space.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid));
+}
+
 typedef uint64 pte_t;
 typedef uint64 *pagetable_t; // 512 PTEs
 
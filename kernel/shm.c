@@ -0,0 +1,190 @@
+//
+// Shared memory segments.
+//
+// A segment is a set of physical pages named by an integer
+// key. Each process that attaches it maps the same pages
+// into one of its NSHMSLOT slots above SHMBASE. A segment
+// is reference counted by its mappings; it and its pages
+// are freed when the last one goes away, whether by
+// shmdt(), exit() or exec().
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+struct shm {
+  int key;
+  int ref;        // number of mappings, 0 if free
+  int npages;
+  uint64 *pages;  // a page of physical page addresses
+};
+
+struct {
+  struct spinlock lock;
+  struct shm seg[NSHM];
+} shmtable;
+
+void
+shminit(void)
+{
+  initlock(&shmtable.lock, "shm");
+}
+
+static void
+shmfree(struct shm *s)
+{
+  int i;
+
+  for(i = 0; i < s->npages; i++)
+    kfree((void*)s->pages[i]);
+  kfree((void*)s->pages);
+  s->pages = 0;
+  s->npages = 0;
+}
+
+// Find the segment key, or make it with npages zeroed
+// pages. Caller must hold shmtable.lock.
+static struct shm*
+shmget(int key, int npages)
+{
+  struct shm *s, *free = 0;
+
+  for(s = shmtable.seg; s < &shmtable.seg[NSHM]; s++){
+    if(s->ref > 0 && s->key == key)
+      return npages <= s->npages ? s : 0;
+    if(s->ref == 0 && free == 0)
+      free = s;
+  }
+  if((s = free) == 0 || npages == 0)
+    return 0;
+  if((s->pages = (uint64*)kalloc()) == 0)
+    return 0;
+  for(s->npages = 0; s->npages < npages; s->npages++){
+    if((s->pages[s->npages] = (uint64)kalloc()) == 0){
+      shmfree(s);
+      return 0;
+    }
+    memset((void*)s->pages[s->npages], 0, PGSIZE);
+  }
+  s->key = key;
+  return s;
+}
+
+// Map s at va in pagetable.
+// Caller must hold shmtable.lock.
+static int
+shmmap(pagetable_t pagetable, uint64 va, struct shm *s)
+{
+  int i;
+
+  for(i = 0; i < s->npages; i++){
+    if(mappages(pagetable, va + i*PGSIZE, PGSIZE, s->pages[i], PTE_R|PTE_W|PTE_U) < 0){
+      uvmunmap(pagetable, va, i, 0);
+      return -1;
+    }
+  }
+  s->ref++;
+  return 0;
+}
+
+// The segment mapped at va in pagetable, if any.
+// Caller must hold shmtable.lock.
+static struct shm*
+shmfind(pagetable_t pagetable, uint64 va)
+{
+  struct shm *s;
+  uint64 pa;
+
+  if((pa = walkaddr(pagetable, va)) == 0)
+    return 0;
+  for(s = shmtable.seg; s < &shmtable.seg[NSHM]; s++)
+    if(s->ref > 0 && s->pages[0] == pa)
+      return s;
+  return 0;
+}
+
+// Attach the segment key to the current process, creating
+// it with size bytes if it doesn't exist.
+// Returns the address it is mapped at, or -1.
+uint64
+shmattach(int key, int size)
+{
+  pagetable_t pagetable = myproc()->pagetable;
+  struct shm *s;
+  uint64 va;
+
+  if(size < 0 || size > SHMSLOT)
+    return -1;
+  acquire(&shmtable.lock);
+  for(va = SHMBASE; va < SHMBASE + NSHMSLOT*SHMSLOT; va += SHMSLOT)
+    if(walkaddr(pagetable, va) == 0)
+      break;
+  if(va == SHMBASE + NSHMSLOT*SHMSLOT ||
+     (s = shmget(key, PGROUNDUP(size) / PGSIZE)) == 0){
+    release(&shmtable.lock);
+    return -1;
+  }
+  if(shmmap(pagetable, va, s) < 0){
+    if(s->ref == 0)
+      shmfree(s);
+    release(&shmtable.lock);
+    return -1;
+  }
+  release(&shmtable.lock);
+  return va;
+}
+
+// Unmap the segment at va from pagetable.
+int
+shmdetach(pagetable_t pagetable, uint64 va)
+{
+  struct shm *s;
+
+  if(va < SHMBASE || (va - SHMBASE) % SHMSLOT != 0)
+    return -1;
+  acquire(&shmtable.lock);
+  if((s = shmfind(pagetable, va)) == 0){
+    release(&shmtable.lock);
+    return -1;
+  }
+  uvmunmap(pagetable, va, s->npages, 0);
+  if(--s->ref == 0)
+    shmfree(s);
+  release(&shmtable.lock);
+  return 0;
+}
+
+// Detach every segment in pagetable,
+// before it is freed.
+void
+shmdetachall(pagetable_t pagetable)
+{
+  uint64 va;
+
+  for(va = SHMBASE; va < SHMBASE + NSHMSLOT*SHMSLOT; va += SHMSLOT)
+    shmdetach(pagetable, va);
+}
+
+// Give a child made by fork() the parent's segments,
+// at the same addresses.
+int
+shmfork(pagetable_t old, pagetable_t new)
+{
+  struct shm *s;
+  uint64 va;
+
+  acquire(&shmtable.lock);
+  for(va = SHMBASE; va < SHMBASE + NSHMSLOT*SHMSLOT; va += SHMSLOT){
+    if((s = shmfind(old, va)) != 0 && shmmap(new, va, s) < 0){
+      release(&shmtable.lock);
+      return -1;
+    }
+  }
+  release(&shmtable.lock);
+  return 0;
+}
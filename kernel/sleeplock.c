@@ -15,6 +15,8 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->readers = 0;
+  lk->writers = 0;
   lk->pid = 0;
 }
 
@@ -22,24 +24,61 @@ void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
-  while (lk->locked) {
+  lk->writers++;
+  while (lk->locked || lk->readers) {
     sleep(lk, &lk->lk);
   }
+  lk->writers--;
   lk->locked = 1;
   lk->pid = myproc()->pid;
   release(&lk->lk);
 }
 
+// Acquire lk along with any number of other shared holders.
+// Waits for exclusive holders, and also for processes that
+// are waiting to hold it exclusively, so that a stream of
+// readers cannot starve them.
+void
+acquiresleep_shared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  while (lk->locked || lk->writers) {
+    sleep(lk, &lk->lk);
+  }
+  lk->readers++;
+  release(&lk->lk);
+}
+
+// Release lk, held either exclusively or shared.
 void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
-  lk->locked = 0;
-  lk->pid = 0;
-  wakeup(lk);
+  if(lk->locked){
+    lk->locked = 0;
+    lk->pid = 0;
+  } else if(lk->readers > 0){
+    lk->readers--;
+  } else
+    panic("releasesleep");
+  if(lk->readers == 0)
+    wakeup(lk);
   release(&lk->lk);
 }
 
+// Does this process hold lk exclusively, or does someone
+// hold it shared? Shared holders aren't recorded.
+int
+holdingsleep_any(struct sleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = (lk->locked && lk->pid == myproc()->pid) || lk->readers > 0;
+  release(&lk->lk);
+  return r;
+}
+
 int
 holdingsleep(struct sleeplock *lk)
 {
@@ -1,6 +1,8 @@
 // Long-term locks for processes
 struct sleeplock {
-  uint locked;       // Is the lock held?
+  uint locked;       // Is the lock held exclusively?
+  int readers;       // Number of shared holders
+  int writers;       // Number waiting to hold it exclusively
   struct spinlock lk; // spinlock protecting this sleep lock
   
   // For debugging:
@@ -9,3 +9,22 @@ struct stat {
   short nlink; // Number of links to file
   uint64 size; // Size of file in bytes
 };
+
+// disk request latency histogram: hist[i] counts requests
+// that took at least LATHIST0<<i r_time() units (but less
+// than LATHIST0<<(i+1)), except that the first and last
+// buckets also take everything below and above.
+#define NLATHIST 10
+#define LATHIST0 64
+
+// virtio disk counters, from diskstat().
+// times are in r_time() units, 0.1us under qemu.
+struct diskstat {
+  uint64 nreq;    // requests completed
+  uint64 npoll;   // ... found done while their submitter polled
+  uint64 nintr;   // ... found done by the interrupt handler
+  uint64 totlat;  // sum of request latencies
+  uint64 maxlat;  // longest request latency
+  uint64 spin;    // how long a submitter polls before sleeping
+  uint64 hist[NLATHIST];
+};
@@ -12,7 +12,7 @@ int
 fetchaddr(uint64 addr, uint64 *ip)
 {
   struct proc *p = myproc();
-  if(addr >= p->sz || addr+sizeof(uint64) > p->sz) // both tests needed, in case of overflow
+  if(addr >= p->group->sz || addr+sizeof(uint64) > p->group->sz) // both tests needed, in case of overflow
     return -1;
   if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
@@ -102,6 +102,26 @@ extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
 extern uint64 sys_getpriority(void);//DONE. 
+extern uint64 sys_diskstat(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_fallocate(void);
+extern uint64 sys_ftruncate(void);
+extern uint64 sys_getdents(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_sendfile(void);
+extern uint64 sys_fcntl(void);
+extern uint64 sys_poll(void);
+extern uint64 sys_pipe2(void);
+extern uint64 sys_shmat(void);
+extern uint64 sys_shmdt(void);
+extern uint64 sys_futex_wait(void);
+extern uint64 sys_futex_wake(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_uring_enter(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -128,6 +148,26 @@ static uint64 (*syscalls[])(void) = {
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
 [SYS_getpriority] sys_getpriority,//DONE. 
+[SYS_diskstat] sys_diskstat,
+[SYS_fsync]   sys_fsync,
+[SYS_fallocate] sys_fallocate,
+[SYS_ftruncate] sys_ftruncate,
+[SYS_getdents] sys_getdents,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_sendfile] sys_sendfile,
+[SYS_fcntl]   sys_fcntl,
+[SYS_poll]    sys_poll,
+[SYS_pipe2]   sys_pipe2,
+[SYS_shmat]   sys_shmat,
+[SYS_shmdt]   sys_shmdt,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_uring_enter] sys_uring_enter,
 };
 
 void
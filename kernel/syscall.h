@@ -21,3 +21,23 @@
 #define SYS_mkdir  20
 #define SYS_close  21
 #define SYS_getpriority 22 //DONE. 
+#define SYS_diskstat 23
+#define SYS_fsync  24
+#define SYS_fallocate 25
+#define SYS_ftruncate 26
+#define SYS_getdents 27
+#define SYS_pread  28
+#define SYS_pwrite 29
+#define SYS_readv  30
+#define SYS_writev 31
+#define SYS_sendfile 32
+#define SYS_fcntl  33
+#define SYS_poll   34
+#define SYS_pipe2  35
+#define SYS_shmat  36
+#define SYS_shmdt  37
+#define SYS_futex_wait 38
+#define SYS_futex_wake 39
+#define SYS_clone  40
+#define SYS_join   41
+#define SYS_uring_enter 42
@@ -15,23 +15,61 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "poll.h"
+#include "uring.h"
+
+// Return in *pf the file open as fd. If the group has other
+// threads, one may close fd while the caller uses the file, so
+// take a reference and return 1; else return 0. The caller
+// passes what fdget() returned to fdput() when done with the
+// file. Return -1 if fd isn't open.
+static int
+fdget(int fd, struct file **pf)
+{
+  struct file *f;
+  struct group *g = myproc()->group;
+
+  if(fd < 0 || fd >= NOFILE)
+    return -1;
+  // only this thread could add another, and it is here.
+  if(g->ref == 1){
+    if((*pf = g->ofile[fd]) == 0)
+      return -1;
+    return 0;
+  }
+  acquire(&g->lock);
+  if((f = g->ofile[fd]) == 0){
+    release(&g->lock);
+    return -1;
+  }
+  filedup(f);
+  release(&g->lock);
+  *pf = f;
+  return 1;
+}
+
+// Done with a file from fdget().
+static void
+fdput(struct file *f, int ref)
+{
+  if(ref)
+    fileclose(f);
+}
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
+// Return as fdget() does.
 static int
 argfd(int n, int *pfd, struct file **pf)
 {
-  int fd;
-  struct file *f;
+  int fd, ref;
 
   argint(n, &fd);
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if((ref = fdget(fd, pf)) < 0)
     return -1;
   if(pfd)
     *pfd = fd;
-  if(pf)
-    *pf = f;
-  return 0;
+  return ref;
 }
 
 // Allocate a file descriptor for the given file.
@@ -40,14 +78,17 @@ static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *p = myproc();
+  struct group *g = myproc()->group;
 
+  acquire(&g->lock);
   for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
+    if(g->ofile[fd] == 0){
+      g->ofile[fd] = f;
+      release(&g->lock);
       return fd;
     }
   }
+  release(&g->lock);
   return -1;
 }
 
@@ -55,13 +96,15 @@ uint64
 sys_dup(void)
 {
   struct file *f;
-  int fd;
+  int fd, ref;
 
-  if(argfd(0, 0, &f) < 0)
+  if((ref = argfd(0, 0, &f)) < 0)
     return -1;
+  // the new fd needs a reference of its own.
+  if(ref == 0)
+    filedup(f);
   if((fd=fdalloc(f)) < 0)
-    return -1;
-  filedup(f);
+    fileclose(f);
   return fd;
 }
 
@@ -69,29 +112,249 @@ uint64
 sys_read(void)
 {
   struct file *f;
-  int n;
+  int n, r, ref;
   uint64 p;
 
   argaddr(1, &p);
   argint(2, &n);
-  if(argfd(0, 0, &f) < 0)
+  if((ref = argfd(0, 0, &f)) < 0)
     return -1;
-  return fileread(f, p, n);
+  r = fileread(f, p, n);
+  fdput(f, ref);
+  return r;
 }
 
 uint64
 sys_write(void)
 {
   struct file *f;
-  int n;
+  int n, r, ref;
   uint64 p;
   
   argaddr(1, &p);
   argint(2, &n);
-  if(argfd(0, 0, &f) < 0)
+  if((ref = argfd(0, 0, &f)) < 0)
     return -1;
 
-  return filewrite(f, p, n);
+  r = filewrite(f, p, n);
+  fdput(f, ref);
+  return r;
+}
+
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  int n, off, r, ref;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(off < 0 || (ref = argfd(0, 0, &f)) < 0)
+    return -1;
+  r = filepread(f, p, n, off);
+  fdput(f, ref);
+  return r;
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off, r, ref;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(off < 0 || (ref = argfd(0, 0, &f)) < 0)
+    return -1;
+  r = filepwrite(f, p, n, off);
+  fdput(f, ref);
+  return r;
+}
+
+// Fetch the nth and n+1th word-sized system call arguments
+// as an array of struct iovec and its length.
+// Returns the length, or -1 if it is bad.
+static int
+argiov(int n, struct iovec *iov)
+{
+  uint64 p;
+  int i, cnt;
+
+  argaddr(n, &p);
+  argint(n+1, &cnt);
+  if(cnt < 0 || cnt > MAXIOV)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, p, cnt*sizeof(iov[0])) < 0)
+    return -1;
+  for(i = 0; i < cnt; i++)
+    if(iov[i].iov_len < 0)
+      return -1;
+  return cnt;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[MAXIOV];
+  int cnt, r, ref;
+
+  if((cnt = argiov(1, iov)) < 0 || (ref = argfd(0, 0, &f)) < 0)
+    return -1;
+  r = filereadv(f, iov, cnt);
+  fdput(f, ref);
+  return r;
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[MAXIOV];
+  int cnt, r, ref;
+
+  if((cnt = argiov(1, iov)) < 0 || (ref = argfd(0, 0, &f)) < 0)
+    return -1;
+  r = filewritev(f, iov, cnt);
+  fdput(f, ref);
+  return r;
+}
+
+// Copy n bytes from in_fd to out_fd without a trip
+// through user space. off is -1 to use in_fd's offset.
+uint64
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int off, n, r, outref, inref;
+
+  argint(2, &off);
+  argint(3, &n);
+  if(off < -1 || n < 0 || (outref = argfd(0, 0, &out)) < 0)
+    return -1;
+  if((inref = argfd(1, 0, &in)) < 0){
+    fdput(out, outref);
+    return -1;
+  }
+  r = filesend(out, in, off, n);
+  fdput(in, inref);
+  fdput(out, outref);
+  return r;
+}
+
+uint64
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg, r, ref;
+
+  argint(1, &cmd);
+  argint(2, &arg);
+  if((ref = argfd(0, 0, &f)) < 0)
+    return -1;
+  r = filecntl(f, cmd, arg);
+  fdput(f, ref);
+  return r;
+}
+
+// Wait for one of n files to be ready.
+// timeout is in ticks, -1 to wait forever.
+uint64
+sys_poll(void)
+{
+  struct pollfd fds[NPOLLFD];
+  struct file *f[NPOLLFD];
+  struct proc *p = myproc();
+  uint64 addr;
+  int i, n, timeout, r;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  argint(2, &timeout);
+  if(n < 0 || n > NPOLLFD || timeout < -1)
+    return -1;
+  if(copyin(p->pagetable, (char*)fds, addr, n*sizeof(fds[0])) < 0)
+    return -1;
+  // hold the files, so that a pipe can't go away
+  // while we are on its wait queue.
+  acquire(&p->group->lock);
+  for(i = 0; i < n; i++){
+    f[i] = 0;
+    if(fds[i].fd >= 0 && fds[i].fd < NOFILE && p->group->ofile[fds[i].fd])
+      f[i] = filedup(p->group->ofile[fds[i].fd]);
+  }
+  release(&p->group->lock);
+  r = pollfiles(f, fds, n, timeout);
+  for(i = 0; i < n; i++)
+    if(f[i])
+      fileclose(f[i]);
+  if(r >= 0 && copyout(p->pagetable, addr, (char*)fds, n*sizeof(fds[0])) < 0)
+    return -1;
+  return r;
+}
+
+// FS system calls return before their updates are on
+// disk; wait until they are.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+  int ref;
+
+  if((ref = argfd(0, 0, &f)) < 0)
+    return -1;
+  log_force();
+  fdput(f, ref);
+  return 0;
+}
+
+uint64
+sys_fallocate(void)
+{
+  struct file *f;
+  int off, len, r, ref;
+
+  argint(1, &off);
+  argint(2, &len);
+  if(off < 0 || len <= 0 || (ref = argfd(0, 0, &f)) < 0)
+    return -1;
+  r = fileallocate(f, off, len);
+  fdput(f, ref);
+  return r;
+}
+
+uint64
+sys_getdents(void)
+{
+  struct file *f;
+  int n, r, ref;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  if(n < 0 || (ref = argfd(0, 0, &f)) < 0)
+    return -1;
+  r = filegetdents(f, p, n);
+  fdput(f, ref);
+  return r;
+}
+
+uint64
+sys_ftruncate(void)
+{
+  struct file *f;
+  int len, r, ref;
+
+  argint(1, &len);
+  if(len < 0 || (ref = argfd(0, 0, &f)) < 0)
+    return -1;
+  r = filetruncate(f, len);
+  fdput(f, ref);
+  return r;
 }
 
 uint64
@@ -99,10 +362,20 @@ sys_close(void)
 {
   int fd;
   struct file *f;
+  struct group *g = myproc()->group;
 
-  if(argfd(0, &fd, &f) < 0)
+  // take fd out of the table and close what was there,
+  // so that two threads closing fd can't both close it.
+  argint(0, &fd);
+  if(fd < 0 || fd >= NOFILE)
+    return -1;
+  acquire(&g->lock);
+  if((f = g->ofile[fd]) == 0){
+    release(&g->lock);
     return -1;
-  myproc()->ofile[fd] = 0;
+  }
+  g->ofile[fd] = 0;
+  release(&g->lock);
   fileclose(f);
   return 0;
 }
@@ -111,12 +384,15 @@ uint64
 sys_fstat(void)
 {
   struct file *f;
+  int r, ref;
   uint64 st; // user pointer to struct stat
 
   argaddr(1, &st);
-  if(argfd(0, 0, &f) < 0)
+  if((ref = argfd(0, 0, &f)) < 0)
     return -1;
-  return filestat(f, st);
+  r = filestat(f, st);
+  fdput(f, ref);
+  return r;
 }
 
 // Create the path new as a link to the same inode as old.
@@ -169,27 +445,10 @@ bad:
   return -1;
 }
 
-// Is the directory dp empty except for "." and ".." ?
-static int
-isdirempty(struct inode *dp)
-{
-  int off;
-  struct dirent de;
-
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("isdirempty: readi");
-    if(de.inum != 0)
-      return 0;
-  }
-  return 1;
-}
-
 uint64
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
   char name[DIRSIZ], path[MAXPATH];
   uint off;
 
@@ -219,9 +478,7 @@ sys_unlink(void)
     goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
+  dirunlink(dp, name, off);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -301,18 +558,13 @@ create(char *path, short type, short major, short minor)
   return 0;
 }
 
-uint64
-sys_open(void)
+// Open path and return a new file descriptor for it.
+static int
+openfile(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  argint(1, &omode);
-  if((n = argstr(0, path, MAXPATH)) < 0)
-    return -1;
 
   begin_op();
 
@@ -357,11 +609,12 @@ sys_open(void)
     f->off = 0;
   }
   f->ip = ip;
+  f->nonblock = (omode & O_NONBLOCK) != 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
 
   if((omode & O_TRUNC) && ip->type == T_FILE){
-    itrunc(ip);
+    itrunc(ip, 0);
   }
 
   iunlock(ip);
@@ -370,6 +623,18 @@ sys_open(void)
   return fd;
 }
 
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  argint(1, &omode);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  return openfile(path, omode);
+}
+
 uint64
 sys_mkdir(void)
 {
@@ -410,7 +675,7 @@ uint64
 sys_chdir(void)
 {
   char path[MAXPATH];
-  struct inode *ip;
+  struct inode *ip, *old;
   struct proc *p = myproc();
   
   begin_op();
@@ -425,9 +690,12 @@ sys_chdir(void)
     return -1;
   }
   iunlock(ip);
-  iput(p->cwd);
+  acquire(&p->group->lock);
+  old = p->group->cwd;
+  p->group->cwd = ip;
+  release(&p->group->lock);
+  iput(old);
   end_op();
-  p->cwd = ip;
   return 0;
 }
 
@@ -474,32 +742,139 @@ sys_exec(void)
   return -1;
 }
 
-uint64
-sys_pipe(void)
+// Create a pipe, store its read and write fds in
+// the user array fdarray.
+static int
+makepipe(uint64 fdarray, int flags)
 {
-  uint64 fdarray; // user pointer to array of two integers
   struct file *rf, *wf;
   int fd0, fd1;
   struct proc *p = myproc();
 
-  argaddr(0, &fdarray);
+  if(flags & ~O_NONBLOCK)
+    return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
+  rf->nonblock = wf->nonblock = (flags & O_NONBLOCK) != 0;
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
+      p->group->ofile[fd0] = 0;
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+    p->group->ofile[fd0] = 0;
+    p->group->ofile[fd1] = 0;
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   return 0;
 }
+
+uint64
+sys_pipe(void)
+{
+  uint64 fdarray; // user pointer to array of two integers
+
+  argaddr(0, &fdarray);
+  return makepipe(fdarray, 0);
+}
+
+// pipe() with flags, currently only O_NONBLOCK.
+uint64
+sys_pipe2(void)
+{
+  uint64 fdarray;
+  int flags;
+
+  argaddr(0, &fdarray);
+  argint(1, &flags);
+  return makepipe(fdarray, flags);
+}
+
+// Carry out one uring_enter() submission, and
+// return what the matching system call would.
+static int
+uringop(struct sqe *e)
+{
+  char path[MAXPATH];
+  struct file *f = 0;
+  int r, ref;
+
+  if(e->op == URING_NOP)
+    return 0;
+  if(e->op == URING_OPEN){
+    if(copyinstr(myproc()->pagetable, path, e->addr, MAXPATH) < 0)
+      return -1;
+    return openfile(path, e->len);
+  }
+  if((ref = fdget(e->fd, &f)) < 0)
+    return -1;
+  switch(e->op){
+  case URING_READ:
+    if(e->off >= 0)
+      r = filepread(f, e->addr, e->len, e->off);
+    else
+      r = fileread(f, e->addr, e->len);
+    break;
+  case URING_WRITE:
+    if(e->off >= 0)
+      r = filepwrite(f, e->addr, e->len, e->off);
+    else
+      r = filewrite(f, e->addr, e->len);
+    break;
+  case URING_FSYNC:
+    log_force();
+    r = 0;
+    break;
+  default:
+    r = -1;
+  }
+  fdput(f, ref);
+  return r;
+}
+
+// Run the submissions queued in a struct uring, in order,
+// for as long as there is room for their completions.
+// Return how many were run, or -1 if the ring is bad.
+uint64
+sys_uring_enter(void)
+{
+  struct proc *p = myproc();
+  uint idx[4];    // sqhead, sqtail, cqhead, cqtail
+  uint64 addr, sq, cq;
+  struct sqe e;
+  struct cqe c;
+  int n;
+
+  argaddr(0, &addr);
+  if(copyin(p->pagetable, (char*)idx, addr, sizeof(idx)) < 0)
+    return -1;
+  if(idx[1] - idx[0] > NURING || idx[3] - idx[2] > NURING)
+    return -1;
+  sq = addr + sizeof(idx);
+  cq = sq + NURING*sizeof(struct sqe);
+
+  for(n = 0; idx[0] != idx[1] && idx[3] - idx[2] < NURING; n++){
+    if(copyin(p->pagetable, (char*)&e, sq + (idx[0] % NURING)*sizeof(e), sizeof(e)) < 0)
+      break;
+    idx[0]++;
+    c.data = e.data;
+    c.res = uringop(&e);
+    c.pad = 0;
+    if(copyout(p->pagetable, cq + (idx[3] % NURING)*sizeof(c), (char*)&c, sizeof(c)) < 0)
+      break;
+    idx[3]++;
+    if(killed(p))
+      break;
+  }
+
+  if(copyout(p->pagetable, addr, (char*)&idx[0], sizeof(uint)) < 0 ||
+     copyout(p->pagetable, addr + 3*sizeof(uint), (char*)&idx[3], sizeof(uint)) < 0)
+    return -1;
+  return n;
+}
@@ -6,6 +6,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "vm.h"
+#include "stat.h"
 
 uint64
 sys_exit(void)
@@ -42,24 +43,27 @@ sys_sbrk(void)
   uint64 addr;
   int t;
   int n;
+  struct group *g = myproc()->group;
 
   argint(0, &n);
   argint(1, &t);
-  addr = myproc()->sz;
 
   if(t == SBRK_EAGER || n < 0) {
-    if(growproc(n) < 0) {
+    if(growproc(n, &addr) < 0) {
       return -1;
     }
   } else {
     // Lazily allocate memory for this process: increase its memory
     // size but don't allocate memory. If the processes uses the
     // memory, vmfault() will allocate it.
-    if(addr + n < addr)
+    acquire(&g->lock);
+    addr = g->sz;
+    if(addr + n < addr || addr + n > SHMBASE){
+      release(&g->lock);
       return -1;
-    if(addr + n > TRAPFRAME)
-      return -1;
-    myproc()->sz += n;
+    }
+    g->sz += n;
+    release(&g->lock);
   }
   return addr;
 }
@@ -113,4 +117,117 @@ sys_getpriority(void)//DONE.
 {
   struct proc *p = myproc();
   return p->queue_level;
-}
\ No newline at end of file
+}
+
+// copy the disk request counters to user space, and
+// set the disk polling threshold if arg 1 is >= 0.
+// the threshold is global, so keep it small enough
+// that one process can't make the disk hog the CPUs.
+uint64
+sys_diskstat(void)
+{
+  uint64 addr;
+  int spin;
+  struct diskstat st;
+
+  argaddr(0, &addr);
+  argint(1, &spin);
+  if(spin > MAXDISKSPIN)
+    return -1;
+  virtio_disk_stat(&st, spin);
+  if(copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// Map the shared memory segment key, making it with
+// size bytes if it doesn't exist yet.
+uint64
+sys_shmat(void)
+{
+  int key, size;
+  uint64 va;
+  struct group *g = myproc()->group;
+
+  argint(0, &key);
+  argint(1, &size);
+  // the group lock keeps threads from changing
+  // the page table at the same time.
+  acquire(&g->lock);
+  va = shmattach(key, size);
+  groupflush(g);
+  release(&g->lock);
+  return va;
+}
+
+uint64
+sys_shmdt(void)
+{
+  uint64 addr;
+  int r;
+  struct group *g = myproc()->group;
+
+  argaddr(0, &addr);
+  acquire(&g->lock);
+  // as in growproc(), other threads' harts could go on
+  // using the segment's pages after it is freed.
+  if(g->ref > 1){
+    release(&g->lock);
+    return -1;
+  }
+  r = shmdetach(myproc()->pagetable, addr);
+  groupflush(g);
+  release(&g->lock);
+  return r;
+}
+
+uint64
+sys_futex_wait(void)
+{
+  uint64 addr;
+  int val, timeout;
+
+  argaddr(0, &addr);
+  argint(1, &val);
+  argint(2, &timeout);
+  if(timeout < -1)
+    return -1;
+  return futexwait(addr, val, timeout);
+}
+
+uint64
+sys_futex_wake(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return futexwake(addr, n);
+}
+
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  argaddr(0, &fn);
+  argaddr(1, &arg);
+  argaddr(2, &stack);
+  if(stack % 16 != 0)
+    return -1;
+  return kclone(fn, arg, stack);
+}
+
+uint64
+sys_join(void)
+{
+  int tid;
+  uint64 p;
+
+  argint(0, &tid);
+  argaddr(1, &p);
+  if(tid < 0)
+    return -1;
+  return kjoin(tid, p);
+}
@@ -5,9 +5,11 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "vdso.h"
 
 struct spinlock tickslock;
 uint ticks;
+struct vdso *vdso;  // mapped read-only at VDSO
 
 #define MLFQ_DEBUG 1//be used for print info. DONE.
 
@@ -22,6 +24,9 @@ void
 trapinit(void)
 {
   initlock(&tickslock, "time");
+  if((vdso = (struct vdso*)kalloc()) == 0)
+    panic("trapinit");
+  memset(vdso, 0, PGSIZE);
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -118,7 +123,7 @@ usertrap(void)
   prepare_return();
 
   // the user page table to switch to, for trampoline.S
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = usersatp(p);
 
   // return to trampoline.S; satp value in a0.
   return satp;
@@ -159,6 +164,12 @@ prepare_return(void)
 
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
+
+  // tell trampoline.S where the trapframe is.
+  w_sscratch(p->trapva);
+
+  // the level may have changed since the last return.
+  p->userdata->priority = p->queue_level;
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -198,12 +209,15 @@ clockintr()
   if(cpuid() == 0){
     acquire(&tickslock);
     ticks++;
+    vdso->ticks = ticks;
     if (ticks % 100 == 0) {
       acquire(&promote_lock);
       promote_needed = 1;
       release(&promote_lock);
     }//DONE.
     wakeup(&ticks);
+    polltick();
+    futextick();
     release(&tickslock);
   }
 
@@ -0,0 +1,36 @@
+// uring_enter() rings, in user memory. The caller
+// fills sq[sqtail % NURING] and bumps sqtail; the kernel
+// consumes entries up to sqtail and posts a completion
+// for each at cq[cqtail % NURING].
+#define NURING 32          // entries per ring
+
+// operations
+#define URING_NOP   0
+#define URING_READ  1      // read(fd, addr, len), or pread at off
+#define URING_WRITE 2      // write(fd, addr, len), or pwrite at off
+#define URING_FSYNC 3      // fsync(fd)
+#define URING_OPEN  4      // open(addr, len), len holding the mode
+
+struct sqe {
+  int op;
+  int fd;
+  uint64 addr;
+  int len;
+  int off;        // -1 to use and advance the file offset
+  uint64 data;    // copied to the completion
+};
+
+struct cqe {
+  uint64 data;
+  int res;        // what the system call would return
+  int pad;
+};
+
+struct uring {
+  uint sqhead;    // advanced by the kernel
+  uint sqtail;    // advanced by the caller
+  uint cqhead;    // advanced by the caller
+  uint cqtail;    // advanced by the kernel
+  struct sqe sq[NURING];
+  struct cqe cq[NURING];
+};
@@ -0,0 +1,13 @@
+// Pages user code can read without a system call.
+
+// the time page, shared by every process at VDSO.
+struct vdso {
+  uint ticks;     // as returned by uptime()
+};
+
+// a page of each thread's own, whose address the
+// kernel leaves in the tp register.
+struct userdata {
+  int pid;        // as returned by getpid()
+  int priority;   // as returned by getpriority()
+};
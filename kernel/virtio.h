@@ -58,6 +58,11 @@ struct virtq_desc {
 };
 #define VRING_DESC_F_NEXT  1 // chained with another descriptor
 #define VRING_DESC_F_WRITE 2 // device writes (vs read)
+#define VRING_DESC_F_INDIRECT 4 // addr/len refer to a table of descriptors
+
+// most data buffers in a single disk request, when the
+// device supports indirect descriptor tables.
+#define MAXSEGS 16
 
 // the (entire) avail ring, from the spec.
 struct virtq_avail {
@@ -87,8 +92,8 @@ struct virtq_used {
 #define VIRTIO_BLK_T_OUT 1 // write the disk
 
 // the format of the first descriptor in a disk request.
-// to be followed by two more descriptors containing
-// the block, and a one-byte status.
+// to be followed by one descriptor per block of data,
+// and then one for a one-byte status.
 struct virtio_blk_req {
   uint32 type; // VIRTIO_BLK_T_IN or ..._OUT
   uint32 reserved;
@@ -14,6 +14,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "stat.h"
 #include "virtio.h"
 
 // the address of virtio mmio register r.
@@ -38,6 +39,12 @@ static struct disk {
   // there are NUM used ring entries.
   struct virtq_used *used;
 
+  // indirect descriptor tables, one per descriptor, each with
+  // room for a header, MAXSEGS data buffers, and a status byte.
+  // used only if the device supports VIRTIO_RING_F_INDIRECT_DESC.
+  struct virtq_desc *indirect;
+  int use_indirect;
+
   // our own book-keeping.
   char free[NUM];  // is a descriptor free?
   uint16 used_idx; // we've looked this far in used[2..NUM].
@@ -46,10 +53,20 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf **b;  // bufs holding consecutive blocks
+    int n;           // number of bufs in b[]
+    void *chan;      // what the submitter sleeps on
+    uint64 start;    // r_time() when submitted
     char status;
   } info[NUM];
 
+  // how long virtio_disk_rwv() polls the used ring before
+  // sleeping, in r_time() units. 0 means always sleep.
+  uint64 spin;
+
+  // per-request latency counters, for tuning spin.
+  struct diskstat stat;
+
   // disk command headers.
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
@@ -64,6 +81,7 @@ virtio_disk_init(void)
   uint32 status = 0;
 
   initlock(&disk.vdisk_lock, "virtio_disk");
+  disk.spin = DISKSPIN;
 
   if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
      *R(VIRTIO_MMIO_VERSION) != 2 ||
@@ -91,8 +109,8 @@ virtio_disk_init(void)
   features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
   features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
-  features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
   *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  disk.use_indirect = (features & (1 << VIRTIO_RING_F_INDIRECT_DESC)) != 0;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
@@ -127,6 +145,12 @@ virtio_disk_init(void)
   memset(disk.avail, 0, PGSIZE);
   memset(disk.used, 0, PGSIZE);
 
+  if(NUM * (MAXSEGS+2) * sizeof(struct virtq_desc) > PGSIZE)
+    panic("virtio disk indirect tables too big");
+  if((disk.indirect = kalloc()) == 0)
+    panic("virtio disk kalloc");
+  memset(disk.indirect, 0, PGSIZE);
+
   // set queue size.
   *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
 
@@ -196,12 +220,11 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+alloc_descs(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -212,64 +235,84 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// start one request for n bufs holding consecutive blocks.
+// with indirect descriptors the request occupies a single
+// ring descriptor; otherwise it is a chain of n+2.
+// caller holds vdisk_lock.
+static void
+submit(struct buf **bs, int n, int write, void *chan)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
-
-  // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  int idx[NUM];
+  int nd = disk.use_indirect ? 1 : n+2;
 
-  // allocate the three descriptors.
-  int idx[3];
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(alloc_descs(idx, nd) == 0)
       break;
-    }
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
 
-  // format the three descriptors.
+  int head = idx[0];
+  struct virtq_desc *tbl = &disk.indirect[head * (MAXSEGS+2)];
+
+  // the spec's Section 5.2 says that block operations use
+  // one descriptor for type/reserved/sector, one or more
+  // for the data, and one for a 1-byte status result.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+  struct virtio_blk_req *buf0 = &disk.ops[head];
 
   if(write)
     buf0->type = VIRTIO_BLK_T_OUT; // write the disk
   else
     buf0->type = VIRTIO_BLK_T_IN; // read the disk
   buf0->reserved = 0;
-  buf0->sector = sector;
-
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
-
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  buf0->sector = bs[0]->blockno * (BSIZE / 512);
+
+  disk.info[head].status = 0xff; // device writes 0 on success
+
+  for(int i = 0; i < n+2; i++){
+    struct virtq_desc *d = disk.use_indirect ? &tbl[i] : &disk.desc[idx[i]];
+    if(i == 0){
+      d->addr = (uint64) buf0;
+      d->len = sizeof(struct virtio_blk_req);
+      d->flags = 0;
+    } else if(i <= n){
+      d->addr = (uint64) bs[i-1]->data;
+      d->len = BSIZE;
+      if(write)
+        d->flags = 0; // device reads b->data
+      else
+        d->flags = VRING_DESC_F_WRITE; // device writes b->data
+    } else {
+      d->addr = (uint64) &disk.info[head].status;
+      d->len = 1;
+      d->flags = VRING_DESC_F_WRITE; // device writes the status
+    }
+    if(i < n+1){
+      d->flags |= VRING_DESC_F_NEXT;
+      d->next = disk.use_indirect ? i+1 : idx[i+1];
+    } else {
+      d->next = 0;
+    }
+  }
 
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  if(disk.use_indirect){
+    disk.desc[head].addr = (uint64) tbl;
+    disk.desc[head].len = (n+2) * sizeof(struct virtq_desc);
+    disk.desc[head].flags = VRING_DESC_F_INDIRECT;
+    disk.desc[head].next = 0;
+  }
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  // record the bufs for virtio_disk_intr().
+  for(int i = 0; i < n; i++)
+    bs[i]->disk = 1;
+  disk.info[head].b = bs;
+  disk.info[head].n = n;
+  disk.info[head].chan = chan;
+  disk.info[head].start = r_time();
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  disk.avail->ring[disk.avail->idx % NUM] = head;
 
   __sync_synchronize();
 
@@ -279,18 +322,118 @@ virtio_disk_rw(struct buf *b, int write)
   __sync_synchronize();
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
+
+// account for a request that took lat time units.
+static void
+record(uint64 lat)
+{
+  int i;
+
+  disk.stat.nreq++;
+  disk.stat.totlat += lat;
+  if(lat > disk.stat.maxlat)
+    disk.stat.maxlat = lat;
+  for(i = 0; i < NLATHIST-1 && lat >= (LATHIST0 << (i+1)); i++)
+    ;
+  disk.stat.hist[i]++;
+}
+
+// process the used ring: mark the bufs of every finished
+// request as done and free its descriptors.
+// self is the sleep channel of a caller that is polling,
+// which needs no wakeup(); 0 from the interrupt handler.
+// caller holds vdisk_lock.
+static void
+reap(void *self)
+{
+  // the device increments disk.used->idx when it
+  // adds an entry to the used ring.
+
+  while(disk.used_idx != disk.used->idx){
+    __sync_synchronize();
+    int id = disk.used->ring[disk.used_idx % NUM].id;
+
+    if(disk.info[id].status != 0)
+      panic("virtio_disk_intr status");
+
+    record(r_time() - disk.info[id].start);
+
+    for(int i = 0; i < disk.info[id].n; i++)
+      disk.info[id].b[i]->disk = 0;   // disk is done with buf
+    if(self != 0 && disk.info[id].chan == self)
+      disk.stat.npoll++;
+    else {
+      disk.stat.nintr++;
+      wakeup(disk.info[id].chan);
+    }
+
+    disk.info[id].b = 0;
+    free_chain(id);
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+    disk.used_idx += 1;
+  }
+}
+
+// are any of the n bufs still owned by the disk?
+static int
+busy(struct buf **bs, int n)
+{
+  for(int i = 0; i < n; i++){
+    if(bs[i]->disk)
+      return 1;
   }
+  return 0;
+}
+
+// read or write n bufs, which need not hold consecutive
+// blocks. each run of consecutive blocks goes to the device
+// as a single request, and all requests are in flight at
+// once. returns when every buf has been transferred.
+void
+virtio_disk_rwv(struct buf **bs, int n, int write)
+{
+  int i, j, max;
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  max = disk.use_indirect ? MAXSEGS : NUM-2;
+
+  acquire(&disk.vdisk_lock);
+
+  for(i = 0; i < n; i = j){
+    for(j = i+1; j < n && j-i < max; j++){
+      if(bs[j]->blockno != bs[j-1]->blockno + 1)
+        break;
+    }
+    submit(bs+i, j-i, write, bs);
+  }
+
+  // qemu often finishes a request within a few microseconds,
+  // much sooner than an interrupt, sleep() and wakeup() take.
+  // so poll the used ring for a while before sleeping.
+  // drop the lock between polls so that other harts can
+  // submit requests or take the interrupt.
+  uint64 t0 = r_time();
+  while(busy(bs, n) && r_time() - t0 < disk.spin){
+    release(&disk.vdisk_lock);
+    acquire(&disk.vdisk_lock);
+    reap(bs);
+  }
+
+  // Wait for virtio_disk_intr() to say the requests have finished.
+  for(i = 0; i < n; i++){
+    while(bs[i]->disk == 1)
+      sleep(bs, &disk.vdisk_lock);
+  }
 
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_rwv(&b, 1, write);
+}
+
 void
 virtio_disk_intr()
 {
@@ -306,22 +449,20 @@ virtio_disk_intr()
 
   __sync_synchronize();
 
-  // the device increments disk.used->idx when it
-  // adds an entry to the used ring.
+  reap(0);
 
-  while(disk.used_idx != disk.used->idx){
-    __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
-
-    if(disk.info[id].status != 0)
-      panic("virtio_disk_intr status");
-
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
-
-    disk.used_idx += 1;
-  }
+  release(&disk.vdisk_lock);
+}
 
+// copy out the request counters, and set the polling
+// threshold to spin unless spin is negative.
+void
+virtio_disk_stat(struct diskstat *st, int spin)
+{
+  acquire(&disk.vdisk_lock);
+  if(spin >= 0)
+    disk.spin = spin;
+  disk.stat.spin = disk.spin;
+  *st = disk.stat;
   release(&disk.vdisk_lock);
 }
@@ -13,6 +13,13 @@
  */
 pagetable_t kernel_pagetable;
 
+/*
+ * whether each group's page table runs with an ASID of its
+ * own, so that traps need not flush the TLB; else all use
+ * the kernel's ASID 0. set by kvminithart().
+ */
+int useasids;
+
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
@@ -70,13 +77,18 @@ kvminit(void)
 
 // Switch the current CPU's h/w page table register to
 // the kernel's page table, and enable paging.
+// Also find out whether the hardware implements
+// enough ASID bits to give each group its own.
 void
 kvminithart()
 {
   // wait for any previous writes to the page table memory to finish.
   sfence_vma();
 
-  w_satp(MAKE_SATP(kernel_pagetable));
+  // unimplemented ASID bits read back as zero.
+  w_satp(MAKE_SATP(kernel_pagetable, 0xffff));
+  useasids = SATP_ASID(r_satp()) >= NPROC;
+  w_satp(MAKE_SATP(kernel_pagetable, 0));
 
   // flush stale entries from the TLB.
   sfence_vma();
@@ -386,7 +398,7 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
     if(pa0 == 0) {
-      if((pa0 = vmfault(pagetable, va0, 0)) == 0) {
+      if((pa0 = vmfault(pagetable, va0, 1)) == 0) {
         return -1;
       }
     }
@@ -447,29 +459,47 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
 // allocate and map user memory if process is referencing a page
 // that was lazily allocated in sys_sbrk().
-// returns 0 if va is invalid or already mapped, or if
-// out of physical memory, and physical address if successful.
+// returns 0 if va is invalid, if it is mapped without the access
+// the fault needs, or if out of physical memory, and physical
+// address if successful.
 uint64
 vmfault(pagetable_t pagetable, uint64 va, int read)
 {
   uint64 mem;
+  pte_t *pte;
   struct proc *p = myproc();
+  struct group *g = p->group;
 
-  if (va >= p->sz)
-    return 0;
+  // the group lock keeps two threads from faulting
+  // the same page in at once.
+  acquire(&g->lock);
+  if (va >= g->sz)
+    goto bad;
   va = PGROUNDDOWN(va);
   if(ismapped(pagetable, va)) {
-    return 0;
+    // another thread faulted it in since this one looked;
+    // only a page without the needed access is a fault.
+    pte = walk(pagetable, va, 0);
+    if((*pte & PTE_U) == 0 || (*pte & (read ? PTE_R : PTE_W)) == 0)
+      goto bad;
+    release(&g->lock);
+    return PTE2PA(*pte);
   }
   mem = (uint64) kalloc();
   if(mem == 0)
-    return 0;
+    goto bad;
   memset((void *) mem, 0, PGSIZE);
   if (mappages(p->pagetable, va, PGSIZE, mem, PTE_W|PTE_U|PTE_R) != 0) {
     kfree((void *)mem);
-    return 0;
+    goto bad;
   }
+  groupflush(g);
+  release(&g->lock);
   return mem;
+
+ bad:
+  release(&g->lock);
+  return 0;
 }
 
 int
@@ -28,6 +28,8 @@ int nblocks;  // Number of data blocks
 
 int fsfd;
 struct superblock sb;
+struct dirent rootents[NINODES];
+int nroot;
 char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
@@ -39,7 +41,9 @@ void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
+uint ientry(uint *ap, uint i);
 void iappend(uint inum, void *p, int n);
+void dirwrite(uint inum, struct dirent *ents, int n);
 void die(const char *);
 
 // convert to riscv byte order
@@ -69,10 +73,9 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
+  uint rootino, inum;
   struct dirent de;
   char buf[BSIZE];
-  struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
@@ -84,6 +87,10 @@ main(int argc, char *argv[])
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
+  // itrunc() of a whole file writes every bitmap block, the
+  // inode, a partial indirect block at each level and the
+  // last data block, all in one transaction.
+  assert(nbitmap + 5 <= MAXOPBLOCKS);
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0)
@@ -120,12 +127,12 @@ main(int argc, char *argv[])
   bzero(&de, sizeof(de));
   de.inum = xshort(rootino);
   strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
+  rootents[nroot++] = de;
 
   bzero(&de, sizeof(de));
   de.inum = xshort(rootino);
   strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  rootents[nroot++] = de;
 
   for(i = 2; i < argc; i++){
     // get rid of "user/"
@@ -154,7 +161,7 @@ main(int argc, char *argv[])
     bzero(&de, sizeof(de));
     de.inum = xshort(inum);
     strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    rootents[nroot++] = de;
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -162,12 +169,7 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  dirwrite(rootino, rootents, nroot);
 
   balloc(freeblock);
 
@@ -251,14 +253,31 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return entry i of the indirect block whose (riscv byte
+// order) address is at *ap, allocating both as needed.
+uint
+ientry(uint *ap, uint i)
+{
+  uint indirect[NINDIRECT];
+
+  if(xint(*ap) == 0){
+    *ap = xint(freeblock++);
+  }
+  rsect(xint(*ap), (char*)indirect);
+  if(indirect[i] == 0){
+    indirect[i] = xint(freeblock++);
+    wsect(xint(*ap), (char*)indirect);
+  }
+  return xint(indirect[i]);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
-  uint fbn, off, n1;
+  uint fbn, bn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -272,16 +291,12 @@ iappend(uint inum, void *xp, int n)
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
+    } else if(fbn < NDIRECT + NINDIRECT){
+      x = ientry(&din.addrs[NDIRECT], fbn - NDIRECT);
     } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
+      bn = fbn - NDIRECT - NINDIRECT;
+      x = xint(ientry(&din.addrs[NDIRECT+1], bn / NINDIRECT));
+      x = ientry(&x, bn % NINDIRECT);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -295,6 +310,62 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+// Write the n entries in ents as the contents of directory
+// inum: one after another if they fit in DIRLINEAR blocks,
+// else as a hash table, as described in kernel/fs.h.
+void
+dirwrite(uint inum, struct dirent *ents, int n)
+{
+  static struct dirent blocks[(NINODES/((DPB-1)/2) + 3) * DPB];
+  struct dirhead hd;
+  struct dinode din;
+  uint nb, b, i, j, k, off;
+
+  if(n <= DIRLINEAR*DPB){
+    iappend(inum, ents, n * sizeof(struct dirent));
+
+    // fix size of the dir to a whole block
+    rinode(inum, &din);
+    off = xint(din.size);
+    off = ((off + BSIZE - 1) / BSIZE) * BSIZE;
+    din.size = xint(off);
+    winode(inum, &din);
+    return;
+  }
+
+  // enough buckets to be at most half full, as the kernel keeps them.
+  for(nb = 2; n - 2 > nb * (DPB-1) / 2; nb++)
+    ;
+  assert((1 + nb) * DPB <= sizeof(blocks) / sizeof(blocks[0]));
+
+  bzero(blocks, sizeof(blocks));
+  blocks[0] = ents[0];  // "."
+  blocks[1] = ents[1];  // ".."
+  bzero(&hd, sizeof(hd));
+  memmove(hd.magic, DIRMAGIC, 2);
+  for(b = 0; b < nb; b++)
+    memmove(&blocks[(1 + b) * DPB], &hd, sizeof(hd));
+  hd.nent = xint(n - 2);
+
+  for(i = 2; i < n; i++){
+    b = dirbucket(dirhash(ents[i].name), nb);
+    for(j = 0; j < nb; j++, b = (b + 1) % nb){
+      for(k = 1; k < DPB; k++){
+        if(blocks[(1 + b) * DPB + k].inum == 0)
+          break;
+      }
+      if(k < DPB)
+        break;
+      // full; mark it passed.
+      ((struct dirhead*)&blocks[(1 + b) * DPB])->passed = xint(1);
+    }
+    assert(j < nb);
+    blocks[(1 + b) * DPB + k] = ents[i];
+  }
+  memmove(&blocks[2], &hd, sizeof(hd));
+  iappend(inum, blocks, (1 + nb) * BSIZE);
+}
+
 void
 die(const char *s)
 {
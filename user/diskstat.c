@@ -0,0 +1,36 @@
+// Print the virtio disk request counters, e.g. to
+// tune the polling threshold:
+//   diskstat         print counters
+//   diskstat spin    set the threshold, then print
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct diskstat st;
+  int spin = -1;
+
+  if(argc > 2){
+    fprintf(2, "usage: diskstat [spin]\n");
+    exit(1);
+  }
+  if(argc == 2)
+    spin = atoi(argv[1]);
+
+  if(diskstat(&st, spin) < 0){
+    fprintf(2, "diskstat: failed\n");
+    exit(1);
+  }
+
+  printf("spin %d\n", (int) st.spin);
+  printf("requests %d (polled %d, interrupt %d)\n",
+         (int) st.nreq, (int) st.npoll, (int) st.nintr);
+  if(st.nreq > 0)
+    printf("latency avg %d max %d\n", (int) (st.totlat / st.nreq), (int) st.maxlat);
+  for(int i = 0; i < NLATHIST; i++)
+    printf("  >= %d: %d\n", LATHIST0 << i, (int) st.hist[i]);
+  exit(0);
+}
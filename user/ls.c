@@ -27,9 +27,8 @@ fmtname(char *path)
 void
 ls(char *path)
 {
-  char buf[512], *p;
-  int fd;
-  struct dirent de;
+  int fd, i, n;
+  struct dirstat ds[32];
   struct stat st;
 
   if((fd = open(path, O_RDONLY)) < 0){
@@ -50,24 +49,12 @@ ls(char *path)
     break;
 
   case T_DIR:
-    if(strlen(path) + 1 + DIRSIZ + 1 > sizeof buf){
-      printf("ls: path too long\n");
-      break;
-    }
-    strcpy(buf, path);
-    p = buf+strlen(buf);
-    *p++ = '/';
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      p[DIRSIZ] = 0;
-      if(stat(buf, &st) < 0){
-        printf("ls: cannot stat %s\n", buf);
-        continue;
-      }
-      printf("%s %d %d %d\n", fmtname(buf), st.type, st.ino, (int) st.size);
+    while((n = getdents(fd, ds, sizeof(ds))) > 0){
+      for(i = 0; i < n / sizeof(ds[0]); i++)
+        printf("%s %d %d %d\n", fmtname(ds[i].name), ds[i].type, ds[i].inum, (int) ds[i].size);
     }
+    if(n < 0)
+      printf("ls: cannot read %s\n", path);
     break;
   }
   close(fd);
@@ -0,0 +1,48 @@
+#include "kernel/types.h"
+#include "user/user.h"
+
+// Threads built on clone() and join(). Each thread
+// runs on a stack of its own from malloc().
+
+#define STACKSIZE 4096
+
+static void
+start(void *arg)
+{
+  struct thread *t = arg;
+
+  t->ret = t->fn(t->arg);
+  exit(0);
+}
+
+// Start a thread running fn(arg). Return 0, or -1
+// if there's no memory or no free process.
+int
+thread_create(struct thread *t, void *(*fn)(void*), void *arg)
+{
+  t->fn = fn;
+  t->arg = arg;
+  t->ret = 0;
+  if((t->stack = malloc(STACKSIZE)) == 0)
+    return -1;
+  // the stack grows down; keep it 16-byte aligned.
+  t->tid = clone(start, t, (char*)t->stack + STACKSIZE);
+  if(t->tid < 0){
+    free(t->stack);
+    return -1;
+  }
+  return 0;
+}
+
+// Wait for t to finish and free its stack. If ret isn't 0,
+// store what its function returned there.
+int
+thread_join(struct thread *t, void **ret)
+{
+  if(join(t->tid, 0) < 0)
+    return -1;
+  free(t->stack);
+  if(ret)
+    *ret = t->ret;
+  return 0;
+}
@@ -3,6 +3,8 @@
 #include "kernel/fcntl.h"
 #include "kernel/riscv.h"
 #include "kernel/vm.h"
+#include "kernel/memlayout.h"
+#include "kernel/vdso.h"
 #include "user/user.h"
 
 //
@@ -159,3 +161,90 @@ sbrklazy(int n) {
   return sys_sbrk(n, SBRK_LAZY);
 }
 
+// These read pages the kernel keeps up to date,
+// rather than making a system call. The kernel
+// leaves the address of this thread's page in tp.
+int
+getpid(void)
+{
+  return ((struct userdata*)r_tp())->pid;
+}
+
+int
+getpriority(void)
+{
+  return ((volatile struct userdata*)r_tp())->priority;
+}
+
+int
+uptime(void)
+{
+  return ((volatile struct vdso*)VDSO)->ticks;
+}
+
+
+// Mutexes as in Drepper's "Futexes Are Tricky":
+// unlocking only makes a system call if someone
+// may be sleeping on the lock.
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->state, 2);
+  while(c != 0){
+    futex_wait(&m->state, 2, -1);
+    c = __sync_lock_test_and_set(&m->state, 2);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__sync_fetch_and_sub(&m->state, 1) != 1){
+    __sync_lock_release(&m->state);
+    futex_wake(&m->state, 1);
+  }
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+// Atomically release m and wait for a signal on c,
+// then take m again. As usual, wakeups can be spurious,
+// so callers should wait in a loop.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = c->seq;
+
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq, -1);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 0x7fffffff);  // all of them
+}
@@ -21,8 +21,11 @@ typedef union header Header;
 static Header base;
 static Header *freep;
 
-void
-free(void *ap)
+// Threads share the free list. A zeroed mutex is unlocked.
+static struct mutex lock;
+
+static void
+release(void *ap)
 {
   Header *bp, *p;
 
@@ -56,16 +59,25 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  release((void*)(hp + 1));
   return freep;
 }
 
+void
+free(void *ap)
+{
+  mutex_lock(&lock);
+  release(ap);
+  mutex_unlock(&lock);
+}
+
 void*
 malloc(uint nbytes)
 {
   Header *p, *prevp;
   uint nunits;
 
+  mutex_lock(&lock);
   nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
   if((prevp = freep) == 0){
     base.s.ptr = freep = prevp = &base;
@@ -81,10 +93,13 @@ malloc(uint nbytes)
         p->s.size = nunits;
       }
       freep = prevp;
+      mutex_unlock(&lock);
       return (void*)(p + 1);
     }
     if(p == freep)
-      if((p = morecore(nunits)) == 0)
+      if((p = morecore(nunits)) == 0){
+        mutex_unlock(&lock);
         return 0;
+      }
   }
 }
@@ -1,6 +1,11 @@
 #define SBRK_ERROR ((char *)-1)
 
 struct stat;
+struct diskstat;
+struct dirstat;
+struct iovec;
+struct pollfd;
+struct uring;
 
 // system calls
 int fork(void);
@@ -20,11 +25,31 @@ int link(const char*, const char*);
 int mkdir(const char*);
 int chdir(const char*);
 int dup(int);
-int getpid(void);
+int sys_getpid(void);
 char* sys_sbrk(int,int);
 int pause(int);
-int uptime(void);
-int getpriority(void);//DONE. 
+int sys_uptime(void);
+int sys_getpriority(void);//DONE. 
+int diskstat(struct diskstat*, int);
+int fsync(int);
+int fallocate(int, int, int);
+int ftruncate(int, int);
+int getdents(int, struct dirstat*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int sendfile(int, int, int, int);
+int fcntl(int, int, int);
+int poll(struct pollfd*, int, int);
+int pipe2(int*, int);
+char* shmat(int, int);
+int shmdt(void*);
+int futex_wait(int*, int, int);
+int futex_wake(int*, int);
+int clone(void(*)(void*), void*, void*);
+int join(int, int*);
+int uring_enter(struct uring*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -40,6 +65,36 @@ int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
 char* sbrk(int);
 char* sbrklazy(int);
+int getpid(void);
+int uptime(void);
+int getpriority(void);
+
+// sleeping locks and condition variables for processes
+// sharing memory, built on futexes.
+struct mutex {
+  int state;  // 0 unlocked, 1 locked, 2 locked and contended
+};
+struct cond {
+  int seq;    // bumped by every signal
+};
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+
+// thread.c
+struct thread {
+  int tid;
+  void *stack;
+  void *(*fn)(void*);
+  void *arg;
+  void *ret;
+};
+int thread_create(struct thread*, void *(*)(void*), void*);
+int thread_join(struct thread*, void**);
 
 // printf.c
 void fprintf(int, const char*, ...) __attribute__ ((format (printf, 2, 3)));
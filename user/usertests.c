@@ -4,6 +4,8 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/poll.h"
+#include "kernel/uring.h"
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
@@ -578,6 +580,11 @@ writetest(char *s)
   }
 }
 
+// blocks in writebig's file: enough to need two of the
+// double-indirect block's entries. a MAXFILE-sized file
+// no longer fits on the disk.
+#define BIGBLOCKS (NDIRECT + NINDIRECT + 2*NINDIRECT)
+
 void
 writebig(char *s)
 {
@@ -589,7 +596,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGBLOCKS; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed i=%d\n", s, i);
@@ -609,7 +616,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n != MAXFILE){
+      if(n != BIGBLOCKS){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -2713,7 +2720,7 @@ lazy_sbrk(char *s)
     p = sbrklazy(0);
   }
 
-  int n = TRAPFRAME-PGSIZE-(uint64)p;
+  int n = SHMBASE-PGSIZE-(uint64)p;
 
   char *p1 = sbrklazy(n);
   if (p1 < 0 || p1 != p) {
@@ -2722,8 +2729,8 @@ lazy_sbrk(char *s)
   }
 
   p = sbrk(PGSIZE);
-  if (p < 0 || (uint64)p != TRAPFRAME-PGSIZE) {
-    printf("sbrk(%d) returned %p, not expected TRAPFRAME-PGSIZE\n", PGSIZE, p);
+  if (p < 0 || (uint64)p != SHMBASE-PGSIZE) {
+    printf("sbrk(%d) returned %p, not expected SHMBASE-PGSIZE\n", PGSIZE, p);
     exit(1);
   }
 
@@ -2748,234 +2755,1573 @@ lazy_sbrk(char *s)
   exit(0);
 }
 
-struct test {
-  void (*f)(char *);
-  char *s;
-} quicktests[] = {
-  {copyin, "copyin"},
-  {copyout, "copyout"},
-  {copyinstr1, "copyinstr1"},
-  {copyinstr2, "copyinstr2"},
-  {copyinstr3, "copyinstr3"},
-  {rwsbrk, "rwsbrk" },
-  {truncate1, "truncate1"},
-  {truncate2, "truncate2"},
-  {truncate3, "truncate3"},
-  {openiputtest, "openiput"},
-  {exitiputtest, "exitiput"},
-  {iputtest, "iput"},
-  {opentest, "opentest"},
-  {writetest, "writetest"},
-  {writebig, "writebig"},
-  {createtest, "createtest"},
-  {dirtest, "dirtest"},
-  {exectest, "exectest"},
-  {pipe1, "pipe1"},
-  {killstatus, "killstatus"},
-  {preempt, "preempt"},
-  {exitwait, "exitwait"},
-  {reparent, "reparent" },
-  {twochildren, "twochildren"},
-  {forkfork, "forkfork"},
-  {forkforkfork, "forkforkfork"},
-  {reparent2, "reparent2"},
-  {mem, "mem"},
-  {sharedfd, "sharedfd"},
-  {fourfiles, "fourfiles"},
-  {createdelete, "createdelete"},
-  {unlinkread, "unlinkread"},
-  {linktest, "linktest"},
-  {concreate, "concreate"},
-  {linkunlink, "linkunlink"},
-  {subdir, "subdir"},
-  {bigwrite, "bigwrite"},
-  {bigfile, "bigfile"},
-  {fourteen, "fourteen"},
-  {rmdot, "rmdot"},
-  {dirfile, "dirfile"},
-  {iref, "iref"},
-  {forktest, "forktest"},
-  {sbrkbasic, "sbrkbasic"},
-  {sbrkmuch, "sbrkmuch"},
-  {kernmem, "kernmem"},
-  {MAXVAplus, "MAXVAplus"},
-  {sbrkfail, "sbrkfail"},
-  {sbrkarg, "sbrkarg"},
-  {validatetest, "validatetest"},
-  {bsstest, "bsstest"},
-  {bigargtest, "bigargtest"},
-  {argptest, "argptest"},
-  {stacktest, "stacktest"},
-  {nowrite, "nowrite"},
-  {pgbug, "pgbug" },
-  {sbrkbugs, "sbrkbugs" },
-  {sbrklast, "sbrklast"},
-  {sbrk8000, "sbrk8000"},
-  {badarg, "badarg" },
-  {lazy_alloc, "lazy_alloc"},
-  {lazy_unmap, "lazy_unmap"},
-  {lazy_copy, "lazy_copy"},
-  {lazy_sbrk, "lazy_sbrk"},
-  { 0, 0},
-};
-
-//
-// Section with tests that take a fair bit of time
-//
-
-// directory that uses indirect blocks
+// fsync() returns once a file's writes are on disk,
+// and rejects bad file descriptors.
 void
-bigdir(char *s)
+fsynctest(char *s)
 {
-  enum { N = 500 };
-  int i, fd;
-  char name[10];
-
-  unlink("bd");
+  int fd;
 
-  fd = open("bd", O_CREATE);
+  unlink("fsyncfile");
+  fd = open("fsyncfile", O_CREATE|O_RDWR);
   if(fd < 0){
-    printf("%s: bigdir create failed\n", s);
+    printf("%s: create fsyncfile failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "abcd", 4) != 4){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(fsync(fd) != 0){
+    printf("%s: fsync failed\n", s);
     exit(1);
   }
   close(fd);
+  if(fsync(fd) != -1){
+    printf("%s: fsync of closed fd succeeded\n", s);
+    exit(1);
+  }
+  unlink("fsyncfile");
+}
 
-  for(i = 0; i < N; i++){
-    name[0] = 'x';
-    name[1] = '0' + (i / 64);
-    name[2] = '0' + (i % 64);
-    name[3] = '\0';
-    if(link("bd", name) != 0){
-      printf("%s: bigdir i=%d link(bd, %s) failed\n", s, i, name);
+// ftruncate and fallocate, including across the
+// double-indirect block.
+void
+ftruncatetest(char *s)
+{
+  int fd, i, n;
+  struct stat st;
+  int nblocks = NDIRECT + NINDIRECT + 20;
+
+  unlink("ftrunc");
+  fd = open("ftrunc", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create ftrunc failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < nblocks; i++){
+    memset(buf, 'a' + i % 26, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write failed\n", s);
       exit(1);
     }
   }
 
-  unlink("bd");
-  for(i = 0; i < N; i++){
-    name[0] = 'x';
-    name[1] = '0' + (i / 64);
-    name[2] = '0' + (i % 64);
-    name[3] = '\0';
-    if(unlink(name) != 0){
-      printf("%s: bigdir unlink failed", s);
+  // shrink into the single-indirect range, mid-block.
+  n = (NDIRECT + 10) * BSIZE + 100;
+  if(ftruncate(fd, n) != 0){
+    printf("%s: ftruncate failed\n", s);
+    exit(1);
+  }
+  if(fstat(fd, &st) < 0 || st.size != n){
+    printf("%s: size %d after ftruncate, expected %d\n", s, (int)st.size, n);
+    exit(1);
+  }
+
+  // grow it back; the old tail must read as zeros.
+  if(fallocate(fd, 0, nblocks * BSIZE) != 0){
+    printf("%s: fallocate failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("ftrunc", O_RDONLY);
+  for(i = 0; i < nblocks; i++){
+    if(read(fd, buf, BSIZE) != BSIZE){
+      printf("%s: read block %d failed\n", s, i);
       exit(1);
     }
+    for(int j = 0; j < BSIZE; j++){
+      char c = (i * BSIZE + j < n) ? 'a' + i % 26 : 0;
+      if(buf[j] != c){
+        printf("%s: block %d byte %d is %d, expected %d\n", s, i, j, buf[j], c);
+        exit(1);
+      }
+    }
+  }
+  if(read(fd, buf, 1) != 0){
+    printf("%s: file longer than expected\n", s);
+    exit(1);
   }
+  if(ftruncate(fd, 0) != -1){
+    printf("%s: ftruncate of read-only fd succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("ftrunc", O_RDWR);
+  if(ftruncate(fd, 0) != 0 || fstat(fd, &st) < 0 || st.size != 0){
+    printf("%s: ftruncate to 0 failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("ftrunc");
 }
 
-// concurrent writes to try to provoke deadlock in the virtio disk
-// driver.
+// several processes read one file at the same time, holding
+// its inode lock shared, while another rewrites it.
 void
-manywrites(char *s)
+sharedread(char *s)
 {
-  int nchildren = 4;
-  int howmany = 30; // increase to look for deadlock
-  
-  for(int ci = 0; ci < nchildren; ci++){
-    int pid = fork();
-    if(pid < 0){
-      printf("fork failed\n");
+  enum { N = 4, NBLOCK = 20, ROUNDS = 10 };
+  int fd, i, j, pid, xstatus;
+
+  unlink("sharedread");
+  fd = open("sharedread", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'x', BSIZE);
+  for(i = 0; i < NBLOCK; i++){
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write failed\n", s);
       exit(1);
     }
+  }
+  close(fd);
 
+  for(i = 0; i < N; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
     if(pid == 0){
-      char name[3];
-      name[0] = 'b';
-      name[1] = 'a' + ci;
-      name[2] = '\0';
-      unlink(name);
-      
-      for(int iters = 0; iters < howmany; iters++){
-        for(int i = 0; i < ci+1; i++){
-          int fd = open(name, O_CREATE | O_RDWR);
-          if(fd < 0){
-            printf("%s: cannot create %s\n", s, name);
-            exit(1);
-          }
-          int sz = sizeof(buf);
-          int cc = write(fd, buf, sz);
-          if(cc != sz){
-            printf("%s: write(%d) ret %d\n", s, sz, cc);
-            exit(1);
+      for(j = 0; j < ROUNDS; j++){
+        if((fd = open("sharedread", O_RDONLY)) < 0){
+          printf("%s: open failed\n", s);
+          exit(1);
+        }
+        int n, tot = 0;
+        while((n = read(fd, buf, BSIZE)) > 0){
+          for(int k = 0; k < n; k++){
+            if(buf[k] != 'x' && buf[k] != 'y'){
+              printf("%s: read wrong byte %d\n", s, buf[k]);
+              exit(1);
+            }
           }
-          close(fd);
+          tot += n;
         }
-        unlink(name);
+        if(tot != NBLOCK*BSIZE){
+          printf("%s: read %d bytes, expected %d\n", s, tot, NBLOCK*BSIZE);
+          exit(1);
+        }
+        close(fd);
       }
-
-      unlink(name);
       exit(0);
     }
   }
 
-  for(int ci = 0; ci < nchildren; ci++){
-    int st = 0;
-    wait(&st);
-    if(st != 0)
-      exit(st);
+  // overwrite in place; the size stays the same.
+  if((fd = open("sharedread", O_WRONLY)) < 0){
+    printf("%s: open for write failed\n", s);
+    exit(1);
   }
-  exit(0);
-}
-
-// regression test. does write() with an invalid buffer pointer cause
-// a block to be allocated for a file that is then not freed when the
-// file is deleted? if the kernel has this bug, it will panic: balloc:
-// out of blocks. assumed_free may need to be raised to be more than
-// the number of free blocks. this test takes a long time.
-void
-badwrite(char *s)
-{
-  int assumed_free = 600;
-  
-  unlink("junk");
-  for(int i = 0; i < assumed_free; i++){
-    int fd = open("junk", O_CREATE|O_WRONLY);
-    if(fd < 0){
-      printf("open junk failed\n");
+  memset(buf, 'y', BSIZE);
+  for(i = 0; i < NBLOCK; i++){
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: rewrite failed\n", s);
       exit(1);
     }
-    write(fd, (char*)0xffffffffffL, 1);
-    close(fd);
-    unlink("junk");
-  }
-
-  int fd = open("junk", O_CREATE|O_WRONLY);
-  if(fd < 0){
-    printf("open junk failed\n");
-    exit(1);
-  }
-  if(write(fd, "x", 1) != 1){
-    printf("write failed\n");
-    exit(1);
   }
   close(fd);
-  unlink("junk");
 
-  exit(0);
+  for(i = 0; i < N; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+  unlink("sharedread");
 }
 
-// test the exec() code that cleans up if it runs out
-// of memory. it's really a test that such a condition
-// doesn't cause a panic.
+// keep more than NINODE distinct inodes in use at once.
 void
-execout(char *s)
+manyinodes(char *s)
 {
-  for(int avail = 0; avail < 15; avail++){
-    int pid = fork();
+  enum { NCHILD = 6, NF = 10 };
+  int i, j, pid, xstatus, ready[2], done[2];
+  char name[16], c;
+
+  if(pipe(ready) < 0 || pipe(done) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
     if(pid < 0){
-      printf("fork failed\n");
+      printf("%s: fork failed\n", s);
       exit(1);
-    } else if(pid == 0){
-      // allocate all of memory.
-      while(1){
-        char *a = sbrk(PGSIZE);
-        if(a == SBRK_ERROR)
-          break;
-        *(a + PGSIZE - 1) = 1;
+    }
+    if(pid == 0){
+      close(ready[0]);
+      close(done[1]);
+      for(j = 0; j < NF; j++){
+        name[0] = 'i';
+        name[1] = 'a' + i;
+        name[2] = 'a' + j;
+        name[3] = 0;
+        if(open(name, O_CREATE|O_RDWR) < 0){
+          printf("%s: create %s failed\n", s, name);
+          exit(1);
+        }
       }
-
-      // free a few pages, in order to let exec() make some
+      write(ready[1], "x", 1);
+      read(done[0], &c, 1);  // returns 0 once the parent closes done[1]
+      for(j = 0; j < NF; j++){
+        name[0] = 'i';
+        name[1] = 'a' + i;
+        name[2] = 'a' + j;
+        name[3] = 0;
+        unlink(name);
+      }
+      exit(0);
+    }
+  }
+  close(ready[1]);
+  close(done[0]);
+  for(i = 0; i < NCHILD; i++){
+    if(read(ready[0], &c, 1) != 1){
+      printf("%s: child failed\n", s);
+      exit(1);
+    }
+  }
+  close(done[1]);
+  close(ready[0]);
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+}
+
+// the directory entry cache must notice names that come
+// and go, including ones it has cached as missing.
+void
+dcachetest(char *s)
+{
+  int fd, i;
+  struct stat st;
+
+  unlink("dcdir/f");
+  unlink("dcdir");
+  if(mkdir("dcdir") != 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3; i++){
+    if(open("dcdir/f", O_RDONLY) >= 0){
+      printf("%s: open of missing file succeeded\n", s);
+      exit(1);
+    }
+    if((fd = open("dcdir/f", O_CREATE|O_RDWR)) < 0){
+      printf("%s: create failed\n", s);
+      exit(1);
+    }
+    if(write(fd, "x", i+1) != i+1){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+    close(fd);
+    if(stat("dcdir/f", &st) < 0 || st.size != i+1){
+      printf("%s: stat after create failed\n", s);
+      exit(1);
+    }
+    if(unlink("dcdir/f") != 0){
+      printf("%s: unlink failed\n", s);
+      exit(1);
+    }
+  }
+
+  // a new directory may reuse the old one's inode number.
+  if(unlink("dcdir") != 0 || mkdir("dcdir") != 0){
+    printf("%s: re-mkdir failed\n", s);
+    exit(1);
+  }
+  if(open("dcdir/f", O_RDONLY) >= 0){
+    printf("%s: file in new directory\n", s);
+    exit(1);
+  }
+  if(link("dcachetest-missing", "dcdir/g") == 0){
+    printf("%s: link of missing file succeeded\n", s);
+    exit(1);
+  }
+  unlink("dcdir");
+}
+
+// a directory big enough to be hashed: every name must be
+// found, missing names must not be, and it must not count as
+// empty until the last name is gone. The names are links to
+// one file, since the file system has too few inodes for N.
+void
+hashdir(char *s)
+{
+  enum { N = 300 };
+  int i, n, fd;
+  char name[8];
+  struct stat st1, st2;
+  struct dirstat ds[16];
+
+  unlink("hd");
+  if(mkdir("hd") != 0){
+    printf("%s: mkdir hd failed\n", s);
+    exit(1);
+  }
+  name[0] = 'h';
+  name[1] = 'd';
+  name[2] = '/';
+  name[6] = 0;
+  for(i = 0; i < N; i++){
+    name[3] = 'a' + i / 100;
+    name[4] = '0' + (i / 10) % 10;
+    name[5] = '0' + i % 10;
+    if(i == 0){
+      if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+        printf("%s: create %s failed\n", s, name);
+        exit(1);
+      }
+      close(fd);
+    } else if(link("hd/a00", name) != 0){
+      printf("%s: link %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    name[3] = 'a' + i / 100;
+    name[4] = '0' + (i / 10) % 10;
+    name[5] = '0' + i % 10;
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf("%s: open %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+    name[3] = 'z';
+    if(open(name, O_RDONLY) >= 0){
+      printf("%s: open of missing %s succeeded\n", s, name);
+      exit(1);
+    }
+  }
+  // the lookups above have pushed "." and ".." of hd
+  // out of the dcache; they aren't in its buckets.
+  if(stat("hd", &st1) < 0 || stat("hd/.", &st2) < 0 || st1.ino != st2.ino){
+    printf("%s: hd/. isn't hd\n", s);
+    exit(1);
+  }
+  if(stat(".", &st1) < 0 || stat("hd/..", &st2) < 0 || st1.ino != st2.ino){
+    printf("%s: hd/.. isn't .\n", s);
+    exit(1);
+  }
+  if(chdir("hd") != 0 || chdir("..") != 0 || stat(".", &st2) < 0 || st1.ino != st2.ino){
+    printf("%s: cd hd/.. failed\n", s);
+    exit(1);
+  }
+  // getdents lists every entry, "." and ".." too.
+  fd = open("hd", O_RDONLY);
+  n = 0;
+  while((i = getdents(fd, ds, sizeof(ds))) > 0)
+    n += i / sizeof(ds[0]);
+  close(fd);
+  if(n != N + 2){
+    printf("%s: getdents found %d entries, not %d\n", s, n, N + 2);
+    exit(1);
+  }
+  if(unlink("hd") == 0){
+    printf("%s: unlink of non-empty hd succeeded\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    name[3] = 'a' + i / 100;
+    name[4] = '0' + (i / 10) % 10;
+    name[5] = '0' + i % 10;
+    if(unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("hd") != 0){
+    printf("%s: unlink of empty hd failed\n", s);
+    exit(1);
+  }
+}
+
+// getdents returns each entry once, with its type and size,
+// however small the buffer.
+void
+getdentstest(char *s)
+{
+  enum { N = 5 };
+  struct dirstat ds[N+3];
+  int fd, i, n, tot, seen;
+  char name[8];
+
+  strcpy(name, "gd/f0");
+  for(i = 0; i < N; i++){
+    name[4] = '0' + i;
+    unlink(name);
+  }
+  unlink("gd/sub");
+  unlink("gd");
+  if(mkdir("gd") != 0 || mkdir("gd/sub") != 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    name[4] = '0' + i;
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0 || write(fd, "abcdefgh", i) != i){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  // one entry at a time.
+  if((fd = open("gd", O_RDONLY)) < 0){
+    printf("%s: open gd failed\n", s);
+    exit(1);
+  }
+  tot = 0;
+  seen = 0;
+  while((n = getdents(fd, &ds[tot], sizeof(ds[0]))) > 0){
+    if(n != sizeof(ds[0]) || tot == N+3){
+      printf("%s: getdents returned %d\n", s, n);
+      exit(1);
+    }
+    tot++;
+  }
+  close(fd);
+  if(n < 0 || tot != N+3){
+    printf("%s: got %d entries, expected %d\n", s, tot, N+3);
+    exit(1);
+  }
+  for(i = 0; i < tot; i++){
+    if(ds[i].name[0] == 'f'){
+      n = ds[i].name[1] - '0';
+      if(ds[i].type != T_FILE || ds[i].size != n || ds[i].name[2] != 0){
+        printf("%s: bad entry %s\n", s, ds[i].name);
+        exit(1);
+      }
+      seen |= 1 << n;
+    } else if(strcmp(ds[i].name, "sub") == 0 || strcmp(ds[i].name, ".") == 0 ||
+              strcmp(ds[i].name, "..") == 0){
+      if(ds[i].type != T_DIR){
+        printf("%s: %s is not a directory\n", s, ds[i].name);
+        exit(1);
+      }
+    } else {
+      printf("%s: unexpected entry %s\n", s, ds[i].name);
+      exit(1);
+    }
+  }
+  if(seen != (1 << N) - 1){
+    printf("%s: missing entries\n", s);
+    exit(1);
+  }
+
+  // all at once, and then nothing.
+  fd = open("gd", O_RDONLY);
+  if(getdents(fd, ds, sizeof(ds)) != tot * sizeof(ds[0]) || getdents(fd, ds, sizeof(ds)) != 0){
+    printf("%s: bulk getdents failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("gd/f1", O_RDONLY);
+  if(getdents(fd, ds, sizeof(ds)) != -1){
+    printf("%s: getdents of a file succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  for(i = 0; i < N; i++){
+    name[4] = '0' + i;
+    unlink(name);
+  }
+  unlink("gd/sub");
+  unlink("gd");
+}
+
+// pread and pwrite at explicit offsets, and readv/writev
+// scattering across buffers.
+void
+preadtest(char *s)
+{
+  int fd, i;
+  char a[8], b[BSIZE*3], c[5];
+  struct iovec iov[3];
+
+  unlink("preadf");
+  fd = open("preadf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "0123456789", 10) != 10){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "ab", 2, 3) != 2 || pread(fd, a, 4, 2) != 4 ||
+     memcmp(a, "2ab5", 4) != 0){
+    printf("%s: pread/pwrite wrong\n", s);
+    exit(1);
+  }
+  // the offset stays at the end of the first write.
+  if(write(fd, "xy", 2) != 2 || pread(fd, a, 8, 8) != 4 ||
+     memcmp(a, "89xy", 4) != 0){
+    printf("%s: pwrite moved the offset\n", s);
+    exit(1);
+  }
+  if(pread(fd, a, 8, 100) != 0){
+    printf("%s: pread past end\n", s);
+    exit(1);
+  }
+
+  // a writev big enough to need several transactions.
+  for(i = 0; i < sizeof(b); i++)
+    b[i] = i % 251;
+  iov[0].iov_base = "hello";
+  iov[0].iov_len = 5;
+  iov[1].iov_base = b;
+  iov[1].iov_len = sizeof(b);
+  iov[2].iov_base = "";
+  iov[2].iov_len = 0;
+  if(writev(fd, iov, 3) != 5 + sizeof(b)){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("preadf", O_RDONLY);
+  memset(b, 0, sizeof(b));
+  iov[0].iov_base = a;
+  iov[0].iov_len = 7;
+  iov[1].iov_base = c;
+  iov[1].iov_len = 5;
+  iov[2].iov_base = b;
+  iov[2].iov_len = sizeof(b);
+  if(readv(fd, iov, 3) != 12 + sizeof(b)){
+    printf("%s: readv failed\n", s);
+    exit(1);
+  }
+  if(memcmp(a, "012ab56", 7) != 0 || memcmp(c, "789xy", 5) != 0){
+    printf("%s: readv wrong\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(b); i++){
+    if(b[i] != (char)(i % 251)){
+      printf("%s: readv wrong at %d\n", s, i);
+      exit(1);
+    }
+  }
+  if(readv(fd, iov, MAXIOV+1) != -1){
+    printf("%s: readv took too many buffers\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("preadf");
+}
+
+// sendfile from a file into a pipe, and from the pipe
+// back out to another file.
+void
+sendfiletest(char *s)
+{
+  int fd, fd2, fds[2], i, pid, xstatus;
+  static char b[BSIZE*5];
+  char c[8];
+
+  for(i = 0; i < sizeof(b); i++)
+    b[i] = i % 253;
+  unlink("sendf1");
+  unlink("sendf2");
+  fd = open("sendf1", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, b, sizeof(b)) != sizeof(b)){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    fd = open("sendf1", O_RDONLY);
+    if(sendfile(fds[1], fd, -1, sizeof(b)) != sizeof(b)){
+      printf("%s: sendfile to pipe failed\n", s);
+      exit(1);
+    }
+    // an explicit offset leaves fd's offset alone.
+    if(sendfile(fds[1], fd, 10, 8) != 8 || read(fd, c, 1) != 0){
+      printf("%s: sendfile at offset failed\n", s);
+      exit(1);
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  fd2 = open("sendf2", O_CREATE|O_RDWR);
+  while((i = sendfile(fd2, fds[0], -1, sizeof(b))) > 0)
+    ;
+  close(fds[0]);
+  wait(&xstatus);
+  if(i != 0 || xstatus != 0){
+    printf("%s: sendfile from pipe failed\n", s);
+    exit(1);
+  }
+  close(fd2);
+
+  fd = open("sendf2", O_RDONLY);
+  for(i = 0; i < sizeof(b); i++)
+    b[i] = 0;
+  if(read(fd, b, sizeof(b)) != sizeof(b) || read(fd, c, 8) != 8){
+    printf("%s: short file\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(b); i++){
+    if(b[i] != (char)(i % 253)){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  for(i = 0; i < 8; i++){
+    if(c[i] != (char)(10 + i)){
+      printf("%s: wrong data at offset\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("sendf1");
+  unlink("sendf2");
+}
+
+// large writes and reads that wrap around the pipe's ring.
+void
+pipebulk(char *s)
+{
+  int fds[2], pid, i, n, tot, xstatus;
+  static char b[3*4096+17];
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(i = 0; i < sizeof(b); i++)
+      b[i] = i % 249;
+    for(i = 0; i < 4; i++){
+      if(write(fds[1], b, sizeof(b)) != sizeof(b)){
+        printf("%s: pipe write failed\n", s);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  tot = 0;
+  while((n = read(fds[0], b, 1000 + tot % 3001)) > 0){
+    for(i = 0; i < n; i++){
+      if(b[i] != (char)((tot + i) % sizeof(b) % 249)){
+        printf("%s: pipe read wrong data at %d\n", s, tot + i);
+        exit(1);
+      }
+    }
+    tot += n;
+  }
+  close(fds[0]);
+  wait(&xstatus);
+  if(tot != 4*sizeof(b) || xstatus != 0){
+    printf("%s: pipe read %d bytes\n", s, tot);
+    exit(1);
+  }
+}
+
+// resize a pipe with fcntl, keeping what is in it.
+void
+pipesize(char *s)
+{
+  int fds[2], i, fd;
+  static char b[4*4096];
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0], F_GETPIPE_SZ, 0) != 4096){
+    printf("%s: wrong default size\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(b); i++)
+    b[i] = i % 241;
+  if(write(fds[1], b, 3000) != 3000){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, 10000) != sizeof(b) ||
+     fcntl(fds[0], F_GETPIPE_SZ, 0) != sizeof(b)){
+    printf("%s: grow failed\n", s);
+    exit(1);
+  }
+  // fits now without a reader.
+  if(write(fds[1], b + 3000, sizeof(b) - 3000) != sizeof(b) - 3000){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, 4096) != -1){
+    printf("%s: shrank a full pipe\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, (MAXPIPE+1)*4096) != -1){
+    printf("%s: grew past MAXPIPE\n", s);
+    exit(1);
+  }
+  if(read(fds[0], b, 8200) != 8200 || fcntl(fds[0], F_SETPIPE_SZ, 8192) != 8192){
+    printf("%s: shrink failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], b + 8200, sizeof(b)) != sizeof(b) - 8200){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(b); i++){
+    if(b[i] != (char)(i % 241)){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  fd = open("README", O_RDONLY);
+  if(fcntl(fd, F_GETPIPE_SZ, 0) != -1){
+    printf("%s: pipe size of a file\n", s);
+    exit(1);
+  }
+  close(fd);
+}
+
+// poll() on several pipes at once.
+void
+polltest(char *s)
+{
+  int p1[2], p2[2], pid, xstatus;
+  struct pollfd fds[3];
+  char c;
+
+  if(pipe(p1) != 0 || pipe(p2) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  fds[0].fd = p1[0];
+  fds[0].events = POLLIN;
+  fds[1].fd = p2[0];
+  fds[1].events = POLLIN;
+  fds[2].fd = p1[1];
+  fds[2].events = POLLOUT;
+  if(poll(fds, 3, 0) != 1 || fds[2].revents != POLLOUT ||
+     fds[0].revents != 0 || fds[1].revents != 0){
+    printf("%s: wrong events on empty pipes\n", s);
+    exit(1);
+  }
+  // only the read ends now; nothing arrives.
+  if(poll(fds, 2, 2) != 0){
+    printf("%s: poll did not time out\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    pause(3);
+    write(p2[1], "x", 1);
+    exit(0);
+  }
+  if(poll(fds, 2, -1) != 1 || fds[1].revents != POLLIN || fds[0].revents != 0){
+    printf("%s: poll missed a write\n", s);
+    exit(1);
+  }
+  if(read(p2[0], &c, 1) != 1 || c != 'x'){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+
+  close(p2[1]);
+  fds[2].fd = 99;
+  if(poll(fds, 3, -1) != 2 || fds[1].revents != POLLHUP || fds[2].revents != POLLNVAL){
+    printf("%s: wrong events on closed pipe\n", s);
+    exit(1);
+  }
+  close(p1[0]);
+  close(p1[1]);
+  close(p2[0]);
+}
+
+// reads and writes on an O_NONBLOCK pipe don't wait.
+void
+nonblockpipe(char *s)
+{
+  int fds[2], n;
+  static char b[3*4096];
+
+  if(pipe2(fds, O_NONBLOCK) != 0){
+    printf("%s: pipe2() failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], b, 10) != -EAGAIN){
+    printf("%s: read of empty pipe didn't fail\n", s);
+    exit(1);
+  }
+  n = fcntl(fds[1], F_GETPIPE_SZ, 0);
+  if(write(fds[1], b, sizeof(b)) != n){
+    printf("%s: write didn't fill the pipe\n", s);
+    exit(1);
+  }
+  if(write(fds[1], b, 1) != -EAGAIN){
+    printf("%s: write to full pipe didn't fail\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0], F_GETFL, 0) != (O_RDONLY|O_NONBLOCK) ||
+     fcntl(fds[1], F_GETFL, 0) != (O_WRONLY|O_NONBLOCK)){
+    printf("%s: wrong F_GETFL\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0], F_SETFL, 0) != 0 || fcntl(fds[0], F_GETFL, 0) != O_RDONLY){
+    printf("%s: F_SETFL failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], b, sizeof(b)) != n){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  close(fds[1]);
+  if(read(fds[0], b, 10) != 0){
+    printf("%s: no end of file\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+}
+
+// a shared memory segment seen by parent and child,
+// and freed once no one has it mapped.
+void
+shmtest(char *s)
+{
+  char *a, *b;
+  int pid, xstatus, i;
+
+  a = shmat(4501, 3*4096);
+  if(a == (char*)-1){
+    printf("%s: shmat failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3*4096; i += 4096){
+    if(a[i] != 0){
+      printf("%s: segment not zeroed\n", s);
+      exit(1);
+    }
+  }
+  if(shmat(4502, 513*4096) != (char*)-1){
+    printf("%s: segment too big\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // inherited at the same address, and attachable again.
+    b = shmat(4501, 0);
+    if(b == (char*)-1 || b == a){
+      printf("%s: second shmat failed\n", s);
+      exit(1);
+    }
+    a[2*4096] = 'x';
+    b[4096] = 'y';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  if(a[2*4096] != 'x' || a[4096] != 'y'){
+    printf("%s: child's writes not seen\n", s);
+    exit(1);
+  }
+  if(shmdt(a) != 0 || shmdt(a) != -1){
+    printf("%s: shmdt failed\n", s);
+    exit(1);
+  }
+  // the segment is gone, and a new one starts out zeroed.
+  a = shmat(4501, 4096);
+  if(a == (char*)-1 || a[0] != 0){
+    printf("%s: segment outlived its mappings\n", s);
+    exit(1);
+  }
+  shmdt(a);
+}
+
+// processes sharing a mutex and a condition variable
+// in shared memory.
+void
+futextest(char *s)
+{
+  struct shared {
+    struct mutex m;
+    struct cond c;
+    int count;
+    int done;
+  } *sh;
+  int i, j, pid, xstatus, t0;
+
+  sh = (struct shared*)shmat(4601, 4096);
+  if(sh == (struct shared*)-1){
+    printf("%s: shmat failed\n", s);
+    exit(1);
+  }
+  mutex_init(&sh->m);
+  cond_init(&sh->c);
+
+  if(futex_wait(&sh->count, 1, -1) != -1){
+    printf("%s: futex_wait didn't see the value change\n", s);
+    exit(1);
+  }
+  t0 = uptime();
+  if(futex_wait(&sh->count, 0, 2) != -1 || uptime() - t0 < 2){
+    printf("%s: futex_wait didn't time out\n", s);
+    exit(1);
+  }
+
+  for(i = 0; i < 3; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      for(j = 0; j < 1000; j++){
+        mutex_lock(&sh->m);
+        sh->count++;
+        mutex_unlock(&sh->m);
+      }
+      mutex_lock(&sh->m);
+      sh->done++;
+      cond_signal(&sh->c);
+      mutex_unlock(&sh->m);
+      exit(0);
+    }
+  }
+
+  mutex_lock(&sh->m);
+  while(sh->done < 3)
+    cond_wait(&sh->c, &sh->m);
+  if(sh->count != 3000){
+    printf("%s: count %d, not 3000\n", s, sh->count);
+    exit(1);
+  }
+  mutex_unlock(&sh->m);
+  for(i = 0; i < 3; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  shmdt(sh);
+}
+
+static struct mutex threadlock;
+static int threadcount;
+static int threadfd;
+
+static void*
+threadadd(void *arg)
+{
+  for(int i = 0; i < 1000; i++){
+    mutex_lock(&threadlock);
+    threadcount++;
+    mutex_unlock(&threadlock);
+  }
+  return arg;
+}
+
+static void*
+threadopen(void *arg)
+{
+  threadfd = open("README", O_RDONLY);
+  // the grown heap is shared too.
+  char *p = malloc(8192);
+  p[8000] = 'x';
+  return p;
+}
+
+// threads share memory and open files, and
+// join() hands back what each one returned.
+void
+threadtest(char *s)
+{
+  struct thread t[4];
+  void *ret;
+  char buf[8];
+  int i;
+
+  mutex_init(&threadlock);
+  threadcount = 0;
+  for(i = 0; i < 4; i++){
+    if(thread_create(&t[i], threadadd, (void*)(uint64)i) < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < 4; i++){
+    if(thread_join(&t[i], &ret) < 0 || ret != (void*)(uint64)i){
+      printf("%s: thread_join failed\n", s);
+      exit(1);
+    }
+  }
+  if(threadcount != 4000){
+    printf("%s: count %d, not 4000\n", s, threadcount);
+    exit(1);
+  }
+
+  threadfd = -1;
+  if(thread_create(&t[0], threadopen, 0) < 0 || thread_join(&t[0], &ret) < 0){
+    printf("%s: thread failed\n", s);
+    exit(1);
+  }
+  if(threadfd < 0 || read(threadfd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: fd from thread not shared\n", s);
+    exit(1);
+  }
+  close(threadfd);
+  if(((char*)ret)[8000] != 'x'){
+    printf("%s: heap from thread not shared\n", s);
+    exit(1);
+  }
+  free(ret);
+
+  // nothing left to join.
+  if(join(0, 0) != -1){
+    printf("%s: join with no threads succeeded\n", s);
+    exit(1);
+  }
+}
+
+static void
+uringpush(struct uring *r, int op, int fd, void *addr, int len, int off)
+{
+  struct sqe *e = &r->sq[r->sqtail % NURING];
+
+  e->op = op;
+  e->fd = fd;
+  e->addr = (uint64)addr;
+  e->len = len;
+  e->off = off;
+  e->data = r->sqtail;
+  r->sqtail++;
+}
+
+// a batch of file operations through uring_enter().
+void
+uringtest(char *s)
+{
+  static struct uring r;
+  char buf[16];
+  int fd, i;
+
+  unlink("uringfile");
+  memset(&r, 0, sizeof(r));
+  uringpush(&r, URING_OPEN, 0, "uringfile", O_CREATE|O_RDWR, 0);
+  if(uring_enter(&r) != 1 || r.sqhead != 1 || r.cqtail != 1){
+    printf("%s: open didn't complete\n", s);
+    exit(1);
+  }
+  if((fd = r.cq[0].res) < 0 || r.cq[0].data != 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  r.cqhead++;
+
+  uringpush(&r, URING_WRITE, fd, "abcdef", 6, -1);
+  uringpush(&r, URING_WRITE, fd, "XY", 2, 1);
+  uringpush(&r, URING_FSYNC, fd, 0, 0, 0);
+  uringpush(&r, URING_READ, fd, buf, sizeof(buf), 0);
+  uringpush(&r, URING_READ, 99, buf, sizeof(buf), 0);
+  if(uring_enter(&r) != 5 || r.cqtail != 6){
+    printf("%s: batch didn't complete\n", s);
+    exit(1);
+  }
+  if(r.cq[1].res != 6 || r.cq[2].res != 2 || r.cq[3].res != 0 ||
+     r.cq[4].res != 6 || r.cq[5].res != -1 || r.cq[4].data != 4){
+    printf("%s: wrong results\n", s);
+    exit(1);
+  }
+  if(memcmp(buf, "aXYdef", 6) != 0){
+    printf("%s: wrong data\n", s);
+    exit(1);
+  }
+
+  // no more than a ring's worth of completions.
+  r.cqhead = r.cqtail;
+  for(i = 0; i < NURING; i++)
+    uringpush(&r, URING_NOP, 0, 0, 0, 0);
+  if(uring_enter(&r) != NURING){
+    printf("%s: nops didn't complete\n", s);
+    exit(1);
+  }
+  uringpush(&r, URING_NOP, 0, 0, 0, 0);
+  if(uring_enter(&r) != 0){
+    printf("%s: completion ring overflowed\n", s);
+    exit(1);
+  }
+  r.cqhead += NURING;
+  if(uring_enter(&r) != 1){
+    printf("%s: nop didn't complete\n", s);
+    exit(1);
+  }
+
+  close(fd);
+  unlink("uringfile");
+}
+
+static void*
+vdsopid(void *arg)
+{
+  return (void*)(uint64)getpid();
+}
+
+// getpid(), uptime() and getpriority() read pages the
+// kernel keeps current, and agree with the system calls.
+void
+vdsotest(char *s)
+{
+  struct thread t;
+  void *ret;
+  int pid, xstatus, i, t0;
+
+  if(getpid() != sys_getpid()){
+    printf("%s: getpid %d, not %d\n", s, getpid(), sys_getpid());
+    exit(1);
+  }
+  t0 = sys_uptime();
+  if(uptime() < t0 || uptime() > t0 + 1){
+    printf("%s: uptime %d, not %d\n", s, uptime(), t0);
+    exit(1);
+  }
+  // the clock moves without a system call.
+  for(i = 0; i < 1000000000 && uptime() == t0; i++)
+    ;
+  if(uptime() == t0){
+    printf("%s: uptime stuck at %d\n", s, t0);
+    exit(1);
+  }
+  // a timer tick may change the level between the two.
+  for(i = 0; i < 10 && getpriority() != sys_getpriority(); i++)
+    ;
+  if(i == 10){
+    printf("%s: getpriority disagrees\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(getpid() == sys_getpid() ? 0 : 1);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: wrong getpid in child\n", s);
+    exit(1);
+  }
+
+  if(thread_create(&t, vdsopid, 0) < 0 || thread_join(&t, &ret) < 0){
+    printf("%s: thread failed\n", s);
+    exit(1);
+  }
+  if((uint64)ret != t.tid){
+    printf("%s: wrong getpid in thread\n", s);
+    exit(1);
+  }
+}
+
+// fallocate and ftruncate far past the end of a file
+// must spread the work over many transactions.
+void
+fallocfar(char *s)
+{
+  int fd, i;
+  struct stat st;
+  char c;
+
+  unlink("fallocfar");
+  fd = open("fallocfar", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  if(fallocate(fd, 1 << 20, 1) != 0 ||
+     fstat(fd, &st) < 0 || st.size != (1 << 20) + 1){
+    printf("%s: fallocate past EOF failed\n", s);
+    exit(1);
+  }
+  if(ftruncate(fd, 0) != 0 || ftruncate(fd, 2 << 20) != 0 ||
+     fstat(fd, &st) < 0 || st.size != 2 << 20){
+    printf("%s: ftruncate past EOF failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 2 << 20; i += 100000){
+    if(pread(fd, &c, 1, i) != 1 || c != 0){
+      printf("%s: byte %d isn't zero\n", s, i);
+      exit(1);
+    }
+  }
+  if(ftruncate(fd, 10) != 0 || fstat(fd, &st) < 0 || st.size != 10){
+    printf("%s: ftruncate down failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("fallocfar");
+}
+
+// all pipes together may grow by no more
+// than MAXPIPEPAGES pages.
+void
+pipebudget(char *s)
+{
+  enum { N = MAXPIPEPAGES / (MAXPIPE-1) + 1 };
+  int fds[N][2], i;
+
+  for(i = 0; i < N; i++){
+    if(pipe(fds[i]) != 0){
+      printf("%s: pipe() failed\n", s);
+      exit(1);
+    }
+    if((fcntl(fds[i][1], F_SETPIPE_SZ, MAXPIPE*4096) < 0) != (i == N-1)){
+      printf("%s: growing pipe %d %s\n", s, i, i == N-1 ? "succeeded" : "failed");
+      exit(1);
+    }
+  }
+  // closing a big pipe gives its pages back.
+  close(fds[0][0]);
+  close(fds[0][1]);
+  if(fcntl(fds[N-1][1], F_SETPIPE_SZ, MAXPIPE*4096) < 0){
+    printf("%s: growing after close failed\n", s);
+    exit(1);
+  }
+  for(i = 1; i < N; i++){
+    close(fds[i][0]);
+    close(fds[i][1]);
+  }
+}
+
+static int shrinkfds[2];
+
+static void*
+threadwait(void *arg)
+{
+  char c;
+
+  read(shrinkfds[0], &c, 1);
+  return 0;
+}
+
+// memory can't shrink while another thread might
+// still be using it, but can once that thread is gone.
+void
+threadshrink(char *s)
+{
+  struct thread t;
+
+  if(pipe(shrinkfds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  // grow the heap after thread_create() has malloc()ed the
+  // thread's stack, so that shrinking it frees only this page.
+  if(thread_create(&t, threadwait, 0) < 0 || sbrk(4096) == (char*)-1){
+    printf("%s: setup failed\n", s);
+    exit(1);
+  }
+  if(sbrk(-4096) != (char*)-1){
+    printf("%s: sbrk shrink with a second thread succeeded\n", s);
+    exit(1);
+  }
+  write(shrinkfds[1], "x", 1);
+  if(thread_join(&t, 0) < 0){
+    printf("%s: thread_join failed\n", s);
+    exit(1);
+  }
+  if(sbrk(-4096) == (char*)-1){
+    printf("%s: sbrk shrink after join failed\n", s);
+    exit(1);
+  }
+  close(shrinkfds[0]);
+  close(shrinkfds[1]);
+}
+
+struct test {
+  void (*f)(char *);
+  char *s;
+} quicktests[] = {
+  {copyin, "copyin"},
+  {copyout, "copyout"},
+  {copyinstr1, "copyinstr1"},
+  {copyinstr2, "copyinstr2"},
+  {copyinstr3, "copyinstr3"},
+  {rwsbrk, "rwsbrk" },
+  {truncate1, "truncate1"},
+  {truncate2, "truncate2"},
+  {truncate3, "truncate3"},
+  {openiputtest, "openiput"},
+  {exitiputtest, "exitiput"},
+  {iputtest, "iput"},
+  {opentest, "opentest"},
+  {writetest, "writetest"},
+  {writebig, "writebig"},
+  {createtest, "createtest"},
+  {dirtest, "dirtest"},
+  {exectest, "exectest"},
+  {pipe1, "pipe1"},
+  {killstatus, "killstatus"},
+  {preempt, "preempt"},
+  {exitwait, "exitwait"},
+  {reparent, "reparent" },
+  {twochildren, "twochildren"},
+  {forkfork, "forkfork"},
+  {forkforkfork, "forkforkfork"},
+  {reparent2, "reparent2"},
+  {mem, "mem"},
+  {sharedfd, "sharedfd"},
+  {fourfiles, "fourfiles"},
+  {createdelete, "createdelete"},
+  {unlinkread, "unlinkread"},
+  {linktest, "linktest"},
+  {concreate, "concreate"},
+  {linkunlink, "linkunlink"},
+  {subdir, "subdir"},
+  {bigwrite, "bigwrite"},
+  {bigfile, "bigfile"},
+  {fourteen, "fourteen"},
+  {rmdot, "rmdot"},
+  {dirfile, "dirfile"},
+  {iref, "iref"},
+  {forktest, "forktest"},
+  {sbrkbasic, "sbrkbasic"},
+  {sbrkmuch, "sbrkmuch"},
+  {kernmem, "kernmem"},
+  {MAXVAplus, "MAXVAplus"},
+  {sbrkfail, "sbrkfail"},
+  {sbrkarg, "sbrkarg"},
+  {validatetest, "validatetest"},
+  {bsstest, "bsstest"},
+  {bigargtest, "bigargtest"},
+  {argptest, "argptest"},
+  {stacktest, "stacktest"},
+  {nowrite, "nowrite"},
+  {pgbug, "pgbug" },
+  {sbrkbugs, "sbrkbugs" },
+  {sbrklast, "sbrklast"},
+  {sbrk8000, "sbrk8000"},
+  {badarg, "badarg" },
+  {lazy_alloc, "lazy_alloc"},
+  {lazy_unmap, "lazy_unmap"},
+  {lazy_copy, "lazy_copy"},
+  {lazy_sbrk, "lazy_sbrk"},
+  {fsynctest, "fsynctest"},
+  {ftruncatetest, "ftruncatetest"},
+  {sharedread, "sharedread"},
+  {manyinodes, "manyinodes"},
+  {dcachetest, "dcachetest"},
+  {hashdir, "hashdir"},
+  {getdentstest, "getdentstest"},
+  {preadtest, "preadtest"},
+  {sendfiletest, "sendfiletest"},
+  {pipebulk, "pipebulk"},
+  {pipesize, "pipesize"},
+  {polltest, "polltest"},
+  {nonblockpipe, "nonblockpipe"},
+  {shmtest, "shmtest"},
+  {futextest, "futextest"},
+  {threadtest, "threadtest"},
+  {uringtest, "uringtest"},
+  {vdsotest, "vdsotest"},
+  {fallocfar, "fallocfar"},
+  {pipebudget, "pipebudget"},
+  {threadshrink, "threadshrink"},
+  { 0, 0},
+};
+
+//
+// Section with tests that take a fair bit of time
+//
+
+// directory that uses indirect blocks
+void
+bigdir(char *s)
+{
+  enum { N = 500 };
+  int i, fd;
+  char name[10];
+
+  unlink("bd");
+
+  fd = open("bd", O_CREATE);
+  if(fd < 0){
+    printf("%s: bigdir create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  for(i = 0; i < N; i++){
+    name[0] = 'x';
+    name[1] = '0' + (i / 64);
+    name[2] = '0' + (i % 64);
+    name[3] = '\0';
+    if(link("bd", name) != 0){
+      printf("%s: bigdir i=%d link(bd, %s) failed\n", s, i, name);
+      exit(1);
+    }
+  }
+
+  unlink("bd");
+  for(i = 0; i < N; i++){
+    name[0] = 'x';
+    name[1] = '0' + (i / 64);
+    name[2] = '0' + (i % 64);
+    name[3] = '\0';
+    if(unlink(name) != 0){
+      printf("%s: bigdir unlink failed", s);
+      exit(1);
+    }
+  }
+}
+
+// concurrent writes to try to provoke deadlock in the virtio disk
+// driver.
+void
+manywrites(char *s)
+{
+  int nchildren = 4;
+  int howmany = 30; // increase to look for deadlock
+  
+  for(int ci = 0; ci < nchildren; ci++){
+    int pid = fork();
+    if(pid < 0){
+      printf("fork failed\n");
+      exit(1);
+    }
+
+    if(pid == 0){
+      char name[3];
+      name[0] = 'b';
+      name[1] = 'a' + ci;
+      name[2] = '\0';
+      unlink(name);
+      
+      for(int iters = 0; iters < howmany; iters++){
+        for(int i = 0; i < ci+1; i++){
+          int fd = open(name, O_CREATE | O_RDWR);
+          if(fd < 0){
+            printf("%s: cannot create %s\n", s, name);
+            exit(1);
+          }
+          int sz = sizeof(buf);
+          int cc = write(fd, buf, sz);
+          if(cc != sz){
+            printf("%s: write(%d) ret %d\n", s, sz, cc);
+            exit(1);
+          }
+          close(fd);
+        }
+        unlink(name);
+      }
+
+      unlink(name);
+      exit(0);
+    }
+  }
+
+  for(int ci = 0; ci < nchildren; ci++){
+    int st = 0;
+    wait(&st);
+    if(st != 0)
+      exit(st);
+  }
+  exit(0);
+}
+
+// regression test. does write() with an invalid buffer pointer cause
+// a block to be allocated for a file that is then not freed when the
+// file is deleted? if the kernel has this bug, it will panic: balloc:
+// out of blocks. assumed_free may need to be raised to be more than
+// the number of free blocks. this test takes a long time.
+void
+badwrite(char *s)
+{
+  int assumed_free = 600;
+  
+  unlink("junk");
+  for(int i = 0; i < assumed_free; i++){
+    int fd = open("junk", O_CREATE|O_WRONLY);
+    if(fd < 0){
+      printf("open junk failed\n");
+      exit(1);
+    }
+    write(fd, (char*)0xffffffffffL, 1);
+    close(fd);
+    unlink("junk");
+  }
+
+  int fd = open("junk", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("open junk failed\n");
+    exit(1);
+  }
+  if(write(fd, "x", 1) != 1){
+    printf("write failed\n");
+    exit(1);
+  }
+  close(fd);
+  unlink("junk");
+
+  exit(0);
+}
+
+// test the exec() code that cleans up if it runs out
+// of memory. it's really a test that such a condition
+// doesn't cause a panic.
+void
+execout(char *s)
+{
+  for(int avail = 0; avail < 15; avail++){
+    int pid = fork();
+    if(pid < 0){
+      printf("fork failed\n");
+      exit(1);
+    } else if(pid == 0){
+      // allocate all of memory.
+      while(1){
+        char *a = sbrk(PGSIZE);
+        if(a == SBRK_ERROR)
+          break;
+        *(a + PGSIZE - 1) = 1;
+      }
+
+      // free a few pages, in order to let exec() make some
       // progress.
       for(int i = 0; i < avail; i++)
         sbrk(-PGSIZE);
@@ -2992,6 +4338,107 @@ execout(char *s)
   exit(0);
 }
 
+// unlinking a file that reaches into the double-indirect
+// range must free all its blocks, indirect ones included:
+// the disk holds only a few such files at once.
+void
+bigfree(char *s)
+{
+  int i, j, fd;
+
+  for(i = 0; i < 3 * FSSIZE / BIGBLOCKS; i++){
+    fd = open("bigfree", O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf("%s: create failed\n", s);
+      exit(1);
+    }
+    for(j = 0; j < BIGBLOCKS; j++){
+      if(write(fd, buf, BSIZE) != BSIZE){
+        printf("%s: round %d: write of block %d failed\n", s, i, j);
+        exit(1);
+      }
+    }
+    close(fd);
+    if(unlink("bigfree") < 0){
+      printf("%s: unlink failed\n", s);
+      exit(1);
+    }
+  }
+}
+
+// blocks reserved for files written in the past must not
+// stay out of use while directories are held open: once
+// a write fails for lack of space, closing things that
+// aren't being written should free almost nothing.
+void
+preallocfull(char *s)
+{
+  enum { NDIR = 8 };
+  char name[8];
+  int dirfd[NDIR];
+  int i, fd, n;
+
+  for(i = 0; i < NDIR; i++){
+    name[0] = 'p';
+    name[1] = 'd';
+    name[2] = '0' + i;
+    name[3] = 0;
+    if(mkdir(name) < 0 || chdir(name) < 0){
+      printf("%s: mkdir %s failed\n", s, name);
+      exit(1);
+    }
+    // grow the directory, and leave a file written in it.
+    fd = open("f", O_CREATE|O_WRONLY);
+    if(fd < 0 || write(fd, "x", 1) != 1){
+      printf("%s: create in %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+    chdir("..");
+    if((dirfd[i] = open(name, O_RDONLY)) < 0){
+      printf("%s: open %s failed\n", s, name);
+      exit(1);
+    }
+  }
+
+  fd = open("pfill", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("%s: create pfill failed\n", s);
+    exit(1);
+  }
+  while(write(fd, buf, BSIZE) == BSIZE)
+    ;
+  close(fd);
+
+  for(i = 0; i < NDIR; i++)
+    close(dirfd[i]);
+
+  fd = open("pfill2", O_CREATE|O_WRONLY);
+  n = 0;
+  if(fd >= 0){
+    while(write(fd, buf, BSIZE) == BSIZE)
+      n++;
+    close(fd);
+  }
+  if(n >= NPREALLOC){
+    printf("%s: %d blocks were held back\n", s, n);
+    exit(1);
+  }
+
+  unlink("pfill");
+  unlink("pfill2");
+  for(i = 0; i < NDIR; i++){
+    name[0] = 'p';
+    name[1] = 'd';
+    name[2] = '0' + i;
+    name[3] = 0;
+    chdir(name);
+    unlink("f");
+    chdir("..");
+    unlink(name);
+  }
+}
+
 // can the kernel tolerate running out of disk space?
 void
 diskfull(char *s)
@@ -3110,6 +4557,8 @@ struct test slowtests[] = {
   {badwrite, "badwrite" },
   {execout, "execout"},
   {diskfull, "diskfull"},
+  {bigfree, "bigfree"},
+  {preallocfull, "preallocfull"},
   {outofinodes, "outofinodes"},
     
   { 0, 0},
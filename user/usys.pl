@@ -9,7 +9,8 @@ print "#include \"kernel/syscall.h\"\n";
 sub entry {
     my $prefix = "sys_";
     my $name = shift;
-    if ($name eq "sbrk") {
+    # these have wrappers in ulib.c.
+    if ($name =~ /^(sbrk|getpid|uptime|getpriority)$/) {
 	print ".global $prefix$name\n";
 	print "$prefix$name:\n";
     } else {
@@ -42,4 +43,24 @@ entry("getpid");
 entry("sbrk");
 entry("pause");
 entry("uptime");
-entry("getpriority");#DONE. 
\ No newline at end of file
+entry("getpriority");#DONE. 
+entry("diskstat");
+entry("fsync");
+entry("fallocate");
+entry("ftruncate");
+entry("getdents");
+entry("pread");
+entry("pwrite");
+entry("readv");
+entry("writev");
+entry("sendfile");
+entry("fcntl");
+entry("poll");
+entry("pipe2");
+entry("shmat");
+entry("shmdt");
+entry("futex_wait");
+entry("futex_wake");
+entry("clone");
+entry("join");
+entry("uring_enter");
\ No newline at end of file